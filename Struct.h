@@ -30,6 +30,7 @@ typedef struct {
 typedef struct {
     int account_no;                  // Account number
     int user_id;                     // Linked to user ID
+    char username[MAX_USERNAME];     // Owner's login name
     double balance;                  // Account balance
     int is_closed;                   // 0 = open, 1 = closed
 } CustomerAccount;
@@ -57,7 +58,7 @@ typedef struct {
     int tx_id;                       // Transaction ID
     int account_no;                  // Account number
     int user_id;                     // Customer ID
-    int tx_type;                     // 1=deposit, 2=withdraw, 3=transfer
+    int tx_type;                     // 1=deposit, 2=withdraw, 3=transfer out, 4=transfer in
     double amount;                   // Transaction amount
     char remark[MAX_REMARK];         // Note or description
 } Transaction;
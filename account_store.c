@@ -0,0 +1,480 @@
+/* account_store.c
+   Fixed-width binary account store (account_db.dat).
+   Every account is one CustomerAccount record (Struct.h) at a known
+   offset, so a balance change is a single pwrite() of that record
+   instead of a rewrite of the whole file.
+
+   The parent loads the whole file once into a MAP_SHARED table before
+   the accept loop; forked sessions read and update balances there and
+   write the touched record back to the file (slot N in the table is
+   always record N on disk).
+
+   account_db.idx is a persistent open-addressing hash (username ->
+   slot) mapped MAP_SHARED, so lookups are O(1) and new accounts are
+   indexed incrementally instead of rebuilding anything. Its header
+   names the account_db.dat it was built from (device, inode and a
+   hash of the indexed usernames in slot order); an index that does
+   not match the file is rebuilt.
+
+   Balance changes are serialized per account with fcntl() write locks
+   on the record's byte range in account_db.dat; sem_account only
+   guards adding new accounts to the table.
+   Designed to be included directly into server.c (no header).
+*/
+
+#include "utils.h"
+#include "Struct.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define ACCOUNT_DB_FILE   "account_db.dat"
+#define ACCOUNT_TEXT_FILE "account_db.txt"   // legacy text format
+#define ACCOUNT_MAGIC     0x44434341u        // "ACCD"
+#define ACCOUNT_VERSION   1
+#define ACCOUNT_ID_BASE   500                // same base get_next_id() used
+#define ACCOUNT_TABLE_CAP (1 << 19)          // max accounts held in shared memory
+
+#define ACCOUNT_INDEX_FILE    "account_db.idx"
+#define ACCOUNT_INDEX_MAGIC   0x58444941u           // "AIDX"
+#define ACCOUNT_INDEX_BUCKETS (ACCOUNT_TABLE_CAP * 2) // power of two, load <= 0.5
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;            // sizeof(CustomerAccount) when written
+    uint32_t reserved;
+} AccountFileHeader;
+
+#define ACCOUNT_OFFSET(slot) \
+    ((off_t)sizeof(AccountFileHeader) + (off_t)(slot) * (off_t)sizeof(CustomerAccount))
+
+/* ------------------------------------------------------------
+   Open (and create if needed) the binary account file.
+   Returns fd or -1. A new file gets its header written first.
+   ------------------------------------------------------------ */
+int account_store_open(void) {
+    int fd = open(ACCOUNT_DB_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) return -1;
+
+    AccountFileHeader hdr;
+    ssize_t r = pread(fd, &hdr, sizeof(hdr), 0);
+    if (r == 0) {
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = ACCOUNT_MAGIC;
+        hdr.version = ACCOUNT_VERSION;
+        hdr.record_size = sizeof(CustomerAccount);
+        if (pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    if (r != (ssize_t)sizeof(hdr) || hdr.magic != ACCOUNT_MAGIC ||
+        hdr.record_size != sizeof(CustomerAccount)) {
+        fprintf(stderr, "%s: bad header, refusing to use it\n", ACCOUNT_DB_FILE);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Number of complete records in the file */
+int account_count(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(AccountFileHeader))
+        return 0;
+    return (int)((st.st_size - sizeof(AccountFileHeader)) / sizeof(CustomerAccount));
+}
+
+int account_read(int fd, int slot, CustomerAccount *out) {
+    ssize_t r = pread(fd, out, sizeof(*out), ACCOUNT_OFFSET(slot));
+    return (r == (ssize_t)sizeof(*out)) ? 0 : -1;
+}
+
+/* Overwrite one record in place: the only I/O a balance change needs */
+int account_write(int fd, int slot, const CustomerAccount *acc) {
+    ssize_t w = pwrite(fd, acc, sizeof(*acc), ACCOUNT_OFFSET(slot));
+    return (w == (ssize_t)sizeof(*acc)) ? 0 : -1;
+}
+
+/* ------------------------------------------------------------
+   One-shot converter: account_db.txt -> account_db.dat
+   Text format: <account_no> <username> <balance>
+   Builds a temp file and renames it into place, so a crash
+   never leaves a half-written store. Returns records written
+   or -1 on error.
+   ------------------------------------------------------------ */
+int account_convert_text(const char *txt_file, const char *bin_file) {
+    char tmp_file[128];
+    snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", bin_file);
+
+    int fd_in = open(txt_file, O_RDONLY);
+    if (fd_in == -1) return -1;
+
+    int fd_out = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_out == -1) {
+        close(fd_in);
+        return -1;
+    }
+
+    AccountFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = ACCOUNT_MAGIC;
+    hdr.version = ACCOUNT_VERSION;
+    hdr.record_size = sizeof(CustomerAccount);
+    if (write(fd_out, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+        close(fd_in);
+        close(fd_out);
+        unlink(tmp_file);
+        return -1;
+    }
+
+    LineReader lr;
+    RecField f[3];
+    char *line;
+    size_t len;
+    int count = 0;
+
+    line_reader_init(&lr, fd_in, 0, -1);
+    while ((line = line_reader_next(&lr, &len)) != NULL) {
+        int acc_no, balance;
+        if (rec_split(line, len, f, 3) != 3 || rec_int(f[0], &acc_no) == -1 ||
+            rec_int(f[2], &balance) == -1)
+            continue;
+
+        CustomerAccount acc;
+        memset(&acc, 0, sizeof(acc));
+        acc.account_no = acc_no;
+        acc.user_id = 0;            // not stored in the text format
+        rec_copy(f[1], acc.username, sizeof(acc.username));
+        acc.balance = balance;
+        acc.is_closed = 0;
+        if (write(fd_out, &acc, sizeof(acc)) != (ssize_t)sizeof(acc)) {
+            close(fd_in);
+            close(fd_out);
+            unlink(tmp_file);
+            return -1;
+        }
+        count++;
+    }
+
+    close(fd_in);
+    if (fsync(fd_out) == -1) {
+        close(fd_out);
+        unlink(tmp_file);
+        return -1;
+    }
+    close(fd_out);
+
+    if (rename(tmp_file, bin_file) != 0) {
+        unlink(tmp_file);
+        return -1;
+    }
+    return count;
+}
+
+/* ------------------------------------------------------------
+   Called once at server startup: if there is no binary store yet
+   but a legacy account_db.txt exists, convert it.
+   ------------------------------------------------------------ */
+void account_store_migrate(void) {
+    if (access(ACCOUNT_DB_FILE, F_OK) == 0) return;
+    if (access(ACCOUNT_TEXT_FILE, F_OK) != 0) return;
+
+    int n = account_convert_text(ACCOUNT_TEXT_FILE, ACCOUNT_DB_FILE);
+    if (n < 0)
+        perror("account_db.txt conversion");
+    else
+        printf("Converted %d accounts from %s to %s\n", n, ACCOUNT_TEXT_FILE, ACCOUNT_DB_FILE);
+}
+
+/* =========================================================
+   SHARED ACCOUNT TABLE
+   ========================================================= */
+typedef struct {
+    int count;                       // records in use (== records on disk)
+    int capacity;
+    int max_account_no;              // highest account number handed out
+    CustomerAccount rec[];           // rec[slot] mirrors file record slot
+} AccountTable;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t nbuckets;
+    int32_t  indexed;                // slots [0, indexed) are in the hash
+    uint32_t names;                  // account_names_hash() of those slots
+    uint64_t dat_dev;                // account_db.dat the index was built from
+    uint64_t dat_ino;
+    int32_t  bucket[];               // slot + 1, 0 = empty
+} AccountIndex;
+
+static AccountTable *acct_table = NULL;  // mapped by the parent, inherited by children
+static AccountIndex *acct_index = NULL;  // file-backed, also inherited
+static int acct_fd = -1;                 // account_db.dat, used only with pread/pwrite
+
+/* FNV-1a over the username */
+static uint32_t account_hash(const char *username) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)username; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Fold the next slot's username into the index's stamp of the file */
+static uint32_t account_names_hash(uint32_t h, const char *username) {
+    const unsigned char *p = (const unsigned char *)username;
+    do {
+        h ^= *p;                     // the '\0' too, so "ab","c" != "a","bc"
+        h *= 16777619u;
+    } while (*p++);
+    return h;
+}
+
+/* Index slot under its username unless that name is already present
+   (the first record for a name wins, as the old file scan did). */
+static void account_index_insert(int slot) {
+    const char *name = acct_table->rec[slot].username;
+    uint32_t mask = acct_index->nbuckets - 1;
+    uint32_t b = account_hash(name) & mask;
+
+    while (acct_index->bucket[b] != 0) {
+        if (strcmp(acct_table->rec[acct_index->bucket[b] - 1].username, name) == 0)
+            return;
+        b = (b + 1) & mask;
+    }
+    acct_index->bucket[b] = slot + 1;
+}
+
+/* ------------------------------------------------------------
+   Map account_db.idx and bring it up to date with the table.
+   A valid index only needs the records appended since it was
+   last written; a missing one, or one built from another
+   account_db.dat (replaced, restored or edited), is rebuilt.
+   ------------------------------------------------------------ */
+static int account_index_open(void) {
+    size_t bytes = sizeof(AccountIndex) + (size_t)ACCOUNT_INDEX_BUCKETS * sizeof(int32_t);
+
+    struct stat dat;
+    if (fstat(acct_fd, &dat) == -1) {
+        perror("stat account_db.dat");
+        return -1;
+    }
+
+    int fd = open(ACCOUNT_INDEX_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        perror("open account_db.idx");
+        return -1;
+    }
+
+    struct stat st;
+    int fresh = (fstat(fd, &st) == -1 || (size_t)st.st_size != bytes);
+    if (fresh && ftruncate(fd, bytes) == -1) {
+        perror("ftruncate account_db.idx");
+        close(fd);
+        return -1;
+    }
+
+    acct_index = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (acct_index == MAP_FAILED) {
+        acct_index = NULL;
+        perror("mmap account_db.idx");
+        return -1;
+    }
+
+    int valid = !fresh && acct_index->magic == ACCOUNT_INDEX_MAGIC &&
+                acct_index->nbuckets == ACCOUNT_INDEX_BUCKETS &&
+                acct_index->dat_dev == (uint64_t)dat.st_dev &&
+                acct_index->dat_ino == (uint64_t)dat.st_ino &&
+                acct_index->indexed >= 0 && acct_index->indexed <= acct_table->count;
+    if (valid) {
+        uint32_t names = 2166136261u;
+        for (int slot = 0; slot < acct_index->indexed; slot++)
+            names = account_names_hash(names, acct_table->rec[slot].username);
+        valid = names == acct_index->names;
+    }
+    if (!valid) {
+        if (!fresh) printf("%s does not match %s, rebuilding it\n", ACCOUNT_INDEX_FILE, ACCOUNT_DB_FILE);
+        memset(acct_index->bucket, 0, (size_t)ACCOUNT_INDEX_BUCKETS * sizeof(int32_t));
+        acct_index->magic = ACCOUNT_INDEX_MAGIC;
+        acct_index->nbuckets = ACCOUNT_INDEX_BUCKETS;
+        acct_index->dat_dev = dat.st_dev;
+        acct_index->dat_ino = dat.st_ino;
+        acct_index->names = 2166136261u;
+        acct_index->indexed = 0;
+    }
+
+    int before = acct_index->indexed;
+    for (int slot = before; slot < acct_table->count; slot++) {
+        account_index_insert(slot);
+        acct_index->names = account_names_hash(acct_index->names, acct_table->rec[slot].username);
+    }
+    acct_index->indexed = acct_table->count;
+
+    if (acct_table->count > before)
+        printf("Indexed %d accounts in %s\n", acct_table->count - before, ACCOUNT_INDEX_FILE);
+    return 0;
+}
+
+/* ------------------------------------------------------------
+   Map the table and load every record from account_db.dat.
+   Must run in the parent before the first fork().
+   Returns number of accounts loaded or -1.
+   ------------------------------------------------------------ */
+int account_table_load(void) {
+    size_t bytes = sizeof(AccountTable) + (size_t)ACCOUNT_TABLE_CAP * sizeof(CustomerAccount);
+
+    acct_table = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (acct_table == MAP_FAILED) {
+        acct_table = NULL;
+        perror("mmap account table");
+        return -1;
+    }
+    acct_table->capacity = ACCOUNT_TABLE_CAP;
+    acct_table->count = 0;
+
+    acct_fd = account_store_open();
+    if (acct_fd == -1) return -1;
+
+    int total = account_count(acct_fd);
+    if (total > ACCOUNT_TABLE_CAP) {
+        fprintf(stderr, "%s: %d accounts exceed table capacity %d\n",
+                ACCOUNT_DB_FILE, total, ACCOUNT_TABLE_CAP);
+        return -1;
+    }
+
+    size_t want = (size_t)total * sizeof(CustomerAccount);
+    size_t done = 0;
+    while (done < want) {
+        ssize_t r = pread(acct_fd, (char *)acct_table->rec + done, want - done,
+                          ACCOUNT_OFFSET(0) + (off_t)done);
+        if (r <= 0) {
+            perror("load account_db.dat");
+            return -1;
+        }
+        done += r;
+    }
+    acct_table->count = total;
+
+    acct_table->max_account_no = ACCOUNT_ID_BASE;
+    for (int i = 0; i < total; i++)
+        if (acct_table->rec[i].account_no > acct_table->max_account_no)
+            acct_table->max_account_no = acct_table->rec[i].account_no;
+
+    if (account_index_open() == -1) return -1;
+    return total;
+}
+
+/* Find an account by username via the hash index; returns slot or -1 */
+int account_table_find(const char *username) {
+    uint32_t mask = acct_index->nbuckets - 1;
+    uint32_t b = account_hash(username) & mask;
+    int32_t v;
+
+    while ((v = acct_index->bucket[b]) != 0) {
+        if (strcmp(acct_table->rec[v - 1].username, username) == 0)
+            return v - 1;
+        b = (b + 1) & mask;
+    }
+    return -1;
+}
+
+CustomerAccount *account_table_get(int slot) {
+    return &acct_table->rec[slot];
+}
+
+/* ------------------------------------------------------------
+   Per-account locks: a write lock on the slot's byte range.
+   They are open-file-description locks on a descriptor of the
+   thread's own, so they exclude other threads of a reactor server
+   as well as other processes, and a crashed session still releases
+   its locks. The fd inherited from the parent is not used: its
+   open file description is shared with every sibling.
+   ------------------------------------------------------------ */
+static __thread int acct_lock_fd = -1;
+static __thread pid_t acct_lock_pid = 0;   // process that opened acct_lock_fd
+
+static int account_lock_fd(void) {
+    pid_t pid = getpid();
+    if (acct_lock_fd == -1 || acct_lock_pid != pid) {
+        acct_lock_fd = open(ACCOUNT_DB_FILE, O_RDWR | O_CLOEXEC);
+        acct_lock_pid = pid;
+    }
+    return acct_lock_fd;
+}
+
+int account_lock(int slot) {
+    int fd = account_lock_fd();
+    if (fd == -1) return -1;
+    return lock_record_ofd(fd, ACCOUNT_OFFSET(slot), sizeof(CustomerAccount), F_WRLCK);
+}
+
+void account_unlock(int slot) {
+    unlock_record_ofd(acct_lock_fd, ACCOUNT_OFFSET(slot), sizeof(CustomerAccount));
+}
+
+/* Lock two accounts in slot order so concurrent transfers between
+   the same pair can never deadlock. */
+int account_lock_pair(int slot_a, int slot_b) {
+    int first = slot_a < slot_b ? slot_a : slot_b;
+    int second = slot_a < slot_b ? slot_b : slot_a;
+
+    if (account_lock(first) == -1) return -1;
+    if (account_lock(second) == -1) {
+        account_unlock(first);
+        return -1;
+    }
+    return 0;
+}
+
+void account_unlock_pair(int slot_a, int slot_b) {
+    account_unlock(slot_a);
+    account_unlock(slot_b);
+}
+
+/* Write slot's in-memory record through to account_db.dat */
+int account_table_persist(int slot) {
+    return account_write(acct_fd, slot, &acct_table->rec[slot]);
+}
+
+/* Write just the balance field of a slot's record. Used for balances
+   taken from the WAL, so no account lock is needed: the other fields
+   of the record are left alone. */
+int account_table_persist_balance(int slot, double balance) {
+    off_t off = ACCOUNT_OFFSET(slot) + (off_t)offsetof(CustomerAccount, balance);
+    return pwrite(acct_fd, &balance, sizeof(balance), off) == sizeof(balance) ? 0 : -1;
+}
+
+/* ------------------------------------------------------------
+   Add a new account to the table and the file.
+   Caller holds sem_account. Returns slot or -1.
+   ------------------------------------------------------------ */
+int account_table_add(CustomerAccount *acc) {
+    int slot = acct_table->count;
+    if (slot >= acct_table->capacity) return -1;
+
+    if (acc->account_no <= 0)
+        acc->account_no = acct_table->max_account_no + 1;
+    if (acc->account_no > acct_table->max_account_no)
+        acct_table->max_account_no = acc->account_no;
+
+    acct_table->rec[slot] = *acc;
+    if (account_table_persist(slot) == -1) return -1;
+
+    // Publish only once the record is on disk: bucket, then counters
+    account_index_insert(slot);
+    acct_index->names = account_names_hash(acct_index->names, acc->username);
+    acct_index->indexed = slot + 1;
+    acct_table->count = slot + 1;
+    return slot;
+}
@@ -14,17 +14,17 @@ extern sem_t *sem_userdb;
    Helper: Add new user (Employee or Manager)
    ------------------------------------------------------------ */
 static void add_new_user(int connfd) {
-    char buffer[256], username[64], password[64], role[32];
-    char filename[64];
+    char username[64], password[64], role[32];
+    const RecSchema *s;
 
     send_message(connfd, "Enter role to add (employee/manager): ");
     if (receive_message(connfd, role, sizeof(role)) <= 0) return;
     trim_newline(role);
 
     if (strcmp(role, "employee") == 0)
-        strcpy(filename, "employee.txt");
+        s = &rf_employee;
     else if (strcmp(role, "manager") == 0)
-        strcpy(filename, "manager.txt");
+        s = &rf_manager;
     else {
         send_message(connfd, "Invalid role type.\n");
         return;
@@ -42,7 +42,7 @@ static void add_new_user(int connfd) {
      sem_wait(sem_userdb);
 
     // 🔹 Check for duplicate username before adding
-    int exists = check_existing_user(filename, username);
+    int exists = rf_find(s, USER_NAME, username, NULL);
     if (exists == 1) {
         sem_post(sem_userdb);
         send_message(connfd, "Error: Username already exists!\n");
@@ -52,10 +52,16 @@ static void add_new_user(int connfd) {
         send_message(connfd, "Error checking username.\n");
         return;
     }
-   
-    
 
-    if (add_user(filename, username, password))
+    Record r;
+    int new_id = id_next(s->file);
+    rf_init(&r, 5);
+    rf_set_int(&r, USER_ID, new_id);
+    rf_set_str(&r, USER_NAME, username);
+    rf_set_str(&r, USER_PASS, password);
+    rf_set_int(&r, USER_ACTIVE, 1);
+    rf_set_int(&r, USER_LOGGED_IN, 0);
+    if (new_id != -1 && rf_append(s, &r) == 0)
         send_message(connfd, "User added successfully!\n");
     else
         send_message(connfd, "Failed to add user.\n");
@@ -64,17 +70,11 @@ static void add_new_user(int connfd) {
 }
 
 /* ------------------------------------------------------------
-   Modify Customer / Employee Details (Pure System Call Version)
+   Modify Customer / Employee Details
    ------------------------------------------------------------ */
 static void modify_user_details(int connfd) {
     char role[32], target_username[64], new_password[64], active_str[8];
-    char filename[64], temp_file[64] = "temp.txt";
-    char buffer[512];
-    int fd_read, fd_write;
-    int found = 0;
-
-    char id_str[16], file_username[64], file_password[64], active_buf[8];
-    int id, active;
+    const RecSchema *s;
 
     // Step 1: Ask which file to modify
     send_message(connfd, "Modify which role? (customer/employee): ");
@@ -82,9 +82,9 @@ static void modify_user_details(int connfd) {
     trim_newline(role);
 
     if (strcmp(role, "customer") == 0)
-        strcpy(filename, "customer.txt");
+        s = &rf_customer;
     else if (strcmp(role, "employee") == 0)
-        strcpy(filename, "employee.txt");
+        s = &rf_employee;
     else {
         send_message(connfd, "Invalid role type.\n");
         return;
@@ -107,97 +107,42 @@ static void modify_user_details(int connfd) {
     int new_active = atoi(active_str);
     if (new_active != 0 && new_active != 1) new_active = 1;
 
-    // Step 5: Lock file
+    // Step 5: Rewrite the matching record
     sem_wait(sem_userdb);
-    fd_read = open(filename, O_RDONLY);
-    if (fd_read < 0) {
-        perror("open");
-        sem_post(sem_userdb);
-        return;
-    }
-
-    fd_write = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_write < 0) {
-        close(fd_read);
-        sem_post(sem_userdb);
-        perror("open temp");
-        return;
-    }
-
-    // Step 6: Read file manually line by line
-    ssize_t n;
-    char line[256];
-    int pos = 0;
-
-    while ((n = read(fd_read, buffer, sizeof(buffer))) > 0) {
-        for (ssize_t i = 0; i < n; i++) {
-            if (buffer[i] == '\n' || pos >= sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-
-                // Parse line manually using strtok (no sscanf)
-                char *token = strtok(line, " ");
-                if (!token) continue;
-                strcpy(id_str, token);
-
-                token = strtok(NULL, " ");
-                if (!token) continue;
-                strcpy(file_username, token);
-
-                token = strtok(NULL, " ");
-                if (!token) continue;
-                strcpy(file_password, token);
-
-                token = strtok(NULL, " ");
-                if (!token) continue;
-                strcpy(active_buf, token);
-
-                id = atoi(id_str);
-                active = atoi(active_buf);
-
-                if (strcmp(file_username, target_username) == 0) {
-                    found = 1;
-
-                    // --- write updated record manually ---
-                    write(fd_write, id_str, strlen(id_str));
-                    write(fd_write, " ", 1);
-                    write(fd_write, file_username, strlen(file_username));
-                    write(fd_write, " ", 1);
-                    write(fd_write, new_password, strlen(new_password));
-                    write(fd_write, " ", 1);
-
-                    char act_buf[8];
-                    sprintf(act_buf, "%d\n", new_active); // just one sprintf for tiny integer
-                    write(fd_write, act_buf, strlen(act_buf));
-                } else {
-                    // --- rewrite old record ---
-                    write(fd_write, id_str, strlen(id_str));
-                    write(fd_write, " ", 1);
-                    write(fd_write, file_username, strlen(file_username));
-                    write(fd_write, " ", 1);
-                    write(fd_write, file_password, strlen(file_password));
-                    write(fd_write, " ", 1);
-                    write(fd_write, active_buf, strlen(active_buf));
-                    write(fd_write, "\n", 1);
-                }
-            } else {
-                line[pos++] = buffer[i];
-            }
-        }
-    }
-
-    close(fd_read);
-    close(fd_write);
+    int n = rf_set_user_details(s, target_username, new_password, new_active);
+    sem_post(sem_userdb);
 
-    if (found) {
-        rename(temp_file, filename);
+    if (n > 0)
         send_message(connfd, "Password and status updated successfully.\n");
-    } else {
-        unlink(temp_file);
+    else if (n == 0)
         send_message(connfd, "User not found.\n");
-    }
+    else
+        send_message(connfd, "Error updating user file.\n");
+}
 
-    sem_post(sem_userdb);
+typedef struct {
+    const char *username;
+    const RecSchema *dest;
+    int new_id;
+    int failed;
+} RoleMove;
+
+/* Copy the user into the destination role file with a new id and
+   drop it from the source; a failed append keeps the source record */
+static int move_user_record(Record *r, void *ctx) {
+    RoleMove *m = ctx;
+    if (!rf_eq(r, USER_NAME, m->username)) return RF_KEEP;
+
+    Record dest = *r;
+    dest.ncols = 5;
+    rf_set_int(&dest, USER_ID, m->new_id);
+    rf_set_int(&dest, USER_LOGGED_IN, 0);
+    if (rf_append(m->dest, &dest) == -1) {
+        m->failed = 1;
+        return RF_KEEP;
+    }
+    m->new_id++;            // duplicates in the source still get unique ids
+    return RF_DROP;
 }
 
 /* ------------------------------------------------------------
@@ -213,12 +158,7 @@ static void modify_user_details(int connfd) {
    ------------------------------------------------------------ */
 static void manage_user_roles(int connfd) {
     char choice_str[8], username[64];
-    char src_file[64], dest_file[64], temp_file[64] = "temp.txt";
-    char buffer[512];
-    int fd_read = -1, fd_write = -1, dest_fd = -1;
-    int found = 0;
-    ssize_t bytes;
-    int pos = 0;
+    const RecSchema *src, *dest;
 
     send_message(connfd, "What do you want to do?\n1. Manager -> Employee\n2. Employee -> Manager\nEnter choice: ");
     if (receive_message(connfd, choice_str, sizeof(choice_str)) <= 0) return;
@@ -226,11 +166,11 @@ static void manage_user_roles(int connfd) {
     int choice = atoi(choice_str);
 
     if (choice == 1) {
-        strcpy(src_file, "manager.txt");
-        strcpy(dest_file, "employee.txt");
+        src = &rf_manager;
+        dest = &rf_employee;
     } else if (choice == 2) {
-        strcpy(src_file, "employee.txt");
-        strcpy(dest_file, "manager.txt");
+        src = &rf_employee;
+        dest = &rf_manager;
     } else {
         send_message(connfd, "Invalid option.\n");
         return;
@@ -243,167 +183,33 @@ static void manage_user_roles(int connfd) {
     sem_wait(sem_userdb);
 
     // 1) Verify destination doesn't already contain this username
-    dest_fd = open(dest_file, O_RDONLY);
-    if (dest_fd >= 0) {
-        char line2[256];
-        ssize_t n2;
-        int p2 = 0;
-        while ((n2 = read(dest_fd, buffer, sizeof(buffer))) > 0) {
-            for (ssize_t i = 0; i < n2; i++) {
-                if (buffer[i] == '\n' || p2 >= (int)sizeof(line2) - 1) {
-                    line2[p2] = '\0';
-                    p2 = 0;
-                    // parse username safely from a copy
-                    char copy[256];
-                    strncpy(copy, line2, sizeof(copy)-1);
-                    copy[sizeof(copy)-1] = '\0';
-                    char *tok = strtok(copy, " ");
-                    if (!tok) continue; // no id
-                    tok = strtok(NULL, " ");
-                    if (!tok) continue; // no username
-                    if (strcmp(tok, username) == 0) {
-                        close(dest_fd);
-                        sem_post(sem_userdb);
-                        send_message(connfd, "User already exists in destination role. Abort.\n");
-                        return;
-                    }
-                } else {
-                    line2[p2++] = buffer[i];
-                }
-            }
-        }
-        close(dest_fd);
-    }
-
-    // compute next id for destination
-    int new_id = get_next_id(dest_file);
-
-    // open source file and temp
-    fd_read = open(src_file, O_RDONLY);
-    if (fd_read < 0) {
+    if (rf_find(dest, USER_NAME, username, NULL) == 1) {
         sem_post(sem_userdb);
-        send_message(connfd, "Error opening source file.\n");
+        send_message(connfd, "User already exists in destination role. Abort.\n");
         return;
     }
 
-    fd_write = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_write < 0) {
-        close(fd_read);
+    // compute next id for destination
+    int new_id = id_next(dest->file);
+    if (new_id == -1) {
         sem_post(sem_userdb);
-        send_message(connfd, "Error creating temp file.\n");
+        send_message(connfd, "Error: cannot allocate user ID.\n");
         return;
     }
 
-    // open dest for append (we'll write new record with new id)
-    dest_fd = open(dest_file, O_WRONLY | O_APPEND | O_CREAT, 0644);
-    if (dest_fd < 0) {
-        close(fd_read);
-        close(fd_write);
-        sem_post(sem_userdb);
-        send_message(connfd, "Error opening destination file.\n");
-        return;
-    }
-
-    // Read source file line-by-line, parse from a copy, write others to temp,
-    // and when match is found, write a NEW record into dest with new_id.
-    char line[256];
-    pos = 0;
-    while ((bytes = read(fd_read, buffer, sizeof(buffer))) > 0) {
-        for (ssize_t i = 0; i < bytes; i++) {
-            if (buffer[i] == '\n' || pos >= (int)sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-
-                // make a copy for tokenization so original line remains intact
-                char line_copy[256];
-                strncpy(line_copy, line, sizeof(line_copy)-1);
-                line_copy[sizeof(line_copy)-1] = '\0';
-
-                char *tok = strtok(line_copy, " ");
-                if (!tok) {
-                    // malformed line, just keep it
-                    write(fd_write, line, strlen(line));
-                    write(fd_write, "\n", 1);
-                    continue;
-                }
-                int src_id = atoi(tok);
-
-                tok = strtok(NULL, " ");
-                if (!tok) {
-                    write(fd_write, line, strlen(line));
-                    write(fd_write, "\n", 1);
-                    continue;
-                }
-                char file_username[128];
-                strncpy(file_username, tok, sizeof(file_username)-1);
-                file_username[sizeof(file_username)-1] = '\0';
-
-                tok = strtok(NULL, " ");
-                if (!tok) {
-                    write(fd_write, line, strlen(line));
-                    write(fd_write, "\n", 1);
-                    continue;
-                }
-                char file_password[128];
-                strncpy(file_password, tok, sizeof(file_password)-1);
-                file_password[sizeof(file_password)-1] = '\0';
-
-                tok = strtok(NULL, " ");
-                if (!tok) {
-                    write(fd_write, line, strlen(line));
-                    write(fd_write, "\n", 1);
-                    continue;
-                }
-                int active = atoi(tok);
-
-                if (strcmp(file_username, username) == 0) {
-                    found = 1;
-                    // write new record to destination with incremented id (new_id)
-                    char id_buf[16], act_buf[8];
-                    snprintf(id_buf, sizeof(id_buf), "%d", new_id);
-                    snprintf(act_buf, sizeof(act_buf), "%d", active);
-
-                    write(dest_fd, id_buf, strlen(id_buf));
-                    write(dest_fd, " ", 1);
-                    write(dest_fd, file_username, strlen(file_username));
-                    write(dest_fd, " ", 1);
-                    write(dest_fd, file_password, strlen(file_password));
-                    write(dest_fd, " ", 1);
-                    write(dest_fd, act_buf, strlen(act_buf));
-                    write(dest_fd, "\n", 1);
-
-                    // increment new_id so multiple transfers in the same run get unique ids
-                    new_id++;
-                    // do NOT write this line into temp -> effectively remove from source
-                } else {
-                    // keep unchanged line in temp
-                    write(fd_write, line, strlen(line));
-                    write(fd_write, "\n", 1);
-                }
-            } else {
-                line[pos++] = buffer[i];
-            }
-        }
-    }
+    // 2) Append to destination and remove from source in one pass
+    RoleMove m = { username, dest, new_id, 0 };
+    int n = rf_update(src, move_user_record, &m);
+    sem_post(sem_userdb);
 
-    close(fd_read);
-    close(fd_write);
-    close(dest_fd);
-
-    if (found) {
-        if (rename(temp_file, src_file) != 0) {
-            send_message(connfd, "Error replacing source file.\n");
-            // cleanup: remove temp
-            unlink(temp_file);
-        } else {
-            send_message(connfd, "User role changed successfully (new ID assigned in destination).\n");
-        }
-    } else {
-        unlink(temp_file);
+    if (n > 0)
+        send_message(connfd, "User role changed successfully (new ID assigned in destination).\n");
+    else if (n == -1)
+        send_message(connfd, "Error replacing source file.\n");
+    else if (m.failed)
+        send_message(connfd, "Error opening destination file.\n");
+    else
         send_message(connfd, "User not found in source role.\n");
-    }
-
-    sem_post(sem_userdb);
 }
 
 
@@ -413,13 +219,6 @@ static void manage_user_roles(int connfd) {
    ------------------------------------------------------------ */
 static void change_admin_password(int connfd) {
     char username[64], old_pass[64], new_pass[64];
-    char buffer[512], line[256];
-    char temp_file[64] = "temp_admin.txt";
-    int fd_read, fd_write;
-    int id, active, found = 0;
-    ssize_t bytes;
-    int pos = 0;
-    char file_username[64], file_password[64];
 
     // Step 1: Take credentials
     send_message(connfd, "Enter your username: ");
@@ -434,89 +233,17 @@ static void change_admin_password(int connfd) {
     if (receive_message(connfd, new_pass, sizeof(new_pass)) <= 0) return;
     trim_newline(new_pass);
 
+    // Step 2: Rewrite the record if username and old password match
     sem_wait(sem_userdb);
-    fd_read = open("admin.txt", O_RDONLY);
-    if (fd_read < 0) {
-        sem_post(sem_userdb);
-        send_message(connfd, "Error opening admin file.\n");
-        return;
-    }
-
-    fd_write = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_write < 0) {
-        close(fd_read);
-        sem_post(sem_userdb);
-        send_message(connfd, "Error creating temp file.\n");
-        return;
-    }
-
-    // Step 2: Read and rewrite file
-    while ((bytes = read(fd_read, buffer, sizeof(buffer))) > 0) {
-        for (ssize_t i = 0; i < bytes; i++) {
-            if (buffer[i] == '\n' || pos >= sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-
-                // Parse manually
-                char *token = strtok(line, " ");
-                if (!token) continue;
-                id = atoi(token);
-
-                token = strtok(NULL, " ");
-                if (!token) continue;
-                strcpy(file_username, token);
-
-                token = strtok(NULL, " ");
-                if (!token) continue;
-                strcpy(file_password, token);
-
-                token = strtok(NULL, " ");
-                if (!token) continue;
-                active = atoi(token);
-
-                // If username and old password match
-                if (strcmp(file_username, username) == 0 &&
-                    strcmp(file_password, old_pass) == 0) {
-
-                    found = 1;
-                    write(fd_write, line, 0); // just to reset, not needed
-
-                    // Write updated line
-                    char id_str[16];
-                    sprintf(id_str, "%d", id);
-
-                    write(fd_write, id_str, strlen(id_str));
-                    write(fd_write, " ", 1);
-                    write(fd_write, file_username, strlen(file_username));
-                    write(fd_write, " ", 1);
-                    write(fd_write, new_pass, strlen(new_pass));
-                    write(fd_write, " ", 1);
-                    char act_str[8];
-                    sprintf(act_str, "%d\n", active);
-                    write(fd_write, act_str, strlen(act_str));
-                } else {
-                    // Keep old line
-                    write(fd_write, line, strlen(line));
-                    write(fd_write, "\n", 1);
-                }
-            } else {
-                line[pos++] = buffer[i];
-            }
-        }
-    }
-
-    close(fd_read);
-    close(fd_write);
+    int n = rf_change_password(&rf_admin, username, old_pass, new_pass, NULL);
+    sem_post(sem_userdb);
 
-    if (found) {
-        rename(temp_file, "admin.txt");
+    if (n > 0)
         send_message(connfd, "Password updated successfully.\n");
-    } else {
-        unlink(temp_file);
+    else if (n == 0)
         send_message(connfd, "Invalid username or password.\n");
-    }
-
-    sem_post(sem_userdb);
+    else
+        send_message(connfd, "Error updating admin file.\n");
 }
 
 
@@ -544,6 +271,7 @@ void admin_menu(int connfd , const char *username) {
 
         if (receive_message(connfd, choice_str, sizeof(choice_str)) <= 0)
             return;
+        session_touch();
         choice = atoi(choice_str);
 
         switch (choice) {
@@ -567,9 +295,9 @@ void admin_menu(int connfd , const char *username) {
             case 6:
                 send_message(connfd, "Exiting system...\n");
                 sem_wait(sem_userdb);
-                mark_user_logged_out("admin.txt", username);
+                session_end();
                 sem_post(sem_userdb);
-                _exit(0);
+                client_exit(connfd);
             default:
                 send_message(connfd, "Option not available yet.\n");
                 break;
@@ -0,0 +1,195 @@
+/* =========================================================
+   TOKENIZER BENCHMARK
+   Parses the real text databases field by field, the way the
+   server does, and times each way of doing it: the sscanf()
+   formats the record loops used before, and rec_split() with its
+   scalar, SSE2 and AVX2 loops. Each file is repeated in memory to
+   a few MB so the time is parsing, not I/O.
+
+   Build & run from the repo root:
+       gcc -O2 bench_tokenizer.c -o bench_tokenizer -pthread
+       ./bench_tokenizer [customer.txt loan_db.txt transactions_db.txt]
+   ========================================================= */
+#define _GNU_SOURCE
+#include <time.h>
+#include "utils.c"
+
+#define BENCH_BYTES (8 << 20)
+#define BENCH_ROUNDS 5
+
+typedef struct {
+    char *buf;       // the file repeated, every '\n' turned into '\0'
+    size_t len;
+    size_t lines;
+} BenchData;
+
+typedef int (*SplitFn)(const char *line, size_t len, RecField *f, int max);
+
+static int split_scalar(const char *line, size_t len, RecField *f, int max) {
+    RecSplit st = { 0, 0 };
+    return rec_split_scalar(line, 0, len, f, max, &st);
+}
+
+#ifdef REC_SIMD
+static int split_sse2(const char *line, size_t len, RecField *f, int max) {
+    RecSplit st = { 0, 0 };
+    size_t i = rec_split_sse2(line, 0, len, f, max, &st);
+    if (i == (size_t)-1) return st.n;
+    return rec_split_scalar(line, i, len, f, max, &st);
+}
+
+static int split_avx2(const char *line, size_t len, RecField *f, int max) {
+    RecSplit st = { 0, 0 };
+    size_t i = rec_split_avx2(line, 0, len, f, max, &st);
+    if (i == (size_t)-1) return st.n;
+    return rec_split_scalar(line, i, len, f, max, &st);
+}
+#endif
+
+static int bench_load(const char *filename, BenchData *d) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return -1;
+    char *file = NULL;
+    size_t cap = 0, n = 0, r;
+    char chunk[4096];
+    while ((r = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        if (n + r > cap) {
+            cap = (n + r) * 2;
+            file = realloc(file, cap);
+        }
+        memcpy(file + n, chunk, r);
+        n += r;
+    }
+    fclose(fp);
+    if (n == 0) {
+        free(file);
+        return -1;
+    }
+
+    size_t copies = BENCH_BYTES / n + 1;
+    d->buf = malloc(copies * (n + 1));
+    d->len = 0;
+    for (size_t c = 0; c < copies; c++) {
+        memcpy(d->buf + d->len, file, n);
+        d->len += n;
+        if (file[n - 1] != '\n') d->buf[d->len++] = '\n';
+    }
+    free(file);
+
+    d->lines = 0;
+    for (size_t i = 0; i < d->len; i++)
+        if (d->buf[i] == '\n') {
+            d->buf[i] = '\0';
+            d->lines++;
+        }
+    return 0;
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ---------- One pass per file layout ----------
+   Each pass extracts every field into a value, as the record
+   loops do, and folds it into a sum so nothing is optimised out. */
+static long pass_sscanf(const BenchData *d, int kind) {
+    long sum = 0;
+    for (const char *p = d->buf, *end = d->buf + d->len; p < end; p += strlen(p) + 1) {
+        int id, a, b;
+        double x, y;
+        char s1[128], s2[128], s3[128];
+        if (kind == 0 && sscanf(p, "%d %127s %127s %d %d", &id, s1, s2, &a, &b) == 5)
+            sum += id + a + b + s1[0] + s2[0];
+        else if (kind == 1 && sscanf(p, "%d %127s %d %127s %127s", &id, s1, &a, s2, s3) == 5)
+            sum += id + a + s1[0] + s2[0] + s3[0];
+        else if (kind == 2 && sscanf(p, "%d %63s %31s %lf %63s %lf", &id, s1, s2, &x, s3, &y) == 6)
+            sum += id + (long)x + (long)y + s1[0] + s2[0] + s3[0];
+    }
+    return sum;
+}
+
+static long pass_split(const BenchData *d, int kind, SplitFn split) {
+    long sum = 0;
+    for (const char *p = d->buf, *end = d->buf + d->len; p < end; ) {
+        size_t len = strlen(p);
+        RecField f[REC_MAX_FIELDS];
+        int n = split(p, len, f, REC_MAX_FIELDS);
+        int id, a, b;
+        double x, y;
+        char s1[128], s2[128], s3[128];
+        if (kind == 0 && n >= 5 && rec_int(f[0], &id) == 0 && rec_int(f[3], &a) == 0 && rec_int(f[4], &b) == 0) {
+            rec_copy(f[1], s1, sizeof(s1));
+            rec_copy(f[2], s2, sizeof(s2));
+            sum += id + a + b + s1[0] + s2[0];
+        } else if (kind == 1 && n >= 5 && rec_int(f[0], &id) == 0 && rec_int(f[2], &a) == 0) {
+            rec_copy(f[1], s1, sizeof(s1));
+            rec_copy(f[3], s2, sizeof(s2));
+            rec_copy(f[4], s3, sizeof(s3));
+            sum += id + a + s1[0] + s2[0] + s3[0];
+        } else if (kind == 2 && n >= 6 && rec_int(f[0], &id) == 0 &&
+                   rec_double(f[3], &x) == 0 && rec_double(f[5], &y) == 0) {
+            rec_copy(f[1], s1, 64);
+            rec_copy(f[2], s2, 32);
+            rec_copy(f[4], s3, 64);
+            sum += id + (long)x + (long)y + s1[0] + s2[0] + s3[0];
+        }
+        p += len + 1;
+    }
+    return sum;
+}
+
+/* Best of BENCH_ROUNDS, in ns per line */
+static double bench_run(const BenchData *d, int kind, SplitFn split, long *sum) {
+    double best = 0;
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        double t0 = bench_now();
+        *sum = split ? pass_split(d, kind, split) : pass_sscanf(d, kind);
+        double t = bench_now() - t0;
+        if (r == 0 || t < best) best = t;
+    }
+    return best * 1e9 / d->lines;
+}
+
+int main(int argc, char *argv[]) {
+    const char *files[3] = { "customer.txt", "loan_db.txt", "transactions_db.txt" };
+    for (int i = 1; i < argc && i <= 3; i++) files[i - 1] = argv[i];
+
+    struct { const char *name; SplitFn fn; } ways[] = {
+        { "sscanf", NULL },
+        { "scalar", split_scalar },
+#ifdef REC_SIMD
+        { "sse2", split_sse2 },
+        { "avx2", __builtin_cpu_supports("avx2") ? split_avx2 : NULL },
+#endif
+        { "rec_split", rec_split },
+    };
+    int nways = sizeof(ways) / sizeof(ways[0]);
+
+    printf("%-22s %8s", "file", "lines");
+    for (int w = 0; w < nways; w++) printf(" %10s", ways[w].name);
+    printf("   (ns/line, best of %d)\n", BENCH_ROUNDS);
+
+    for (int k = 0; k < 3; k++) {
+        BenchData d;
+        if (bench_load(files[k], &d) == -1) {
+            perror(files[k]);
+            continue;
+        }
+        long want = 0, sum;
+        printf("%-22s %8zu", files[k], d.lines);
+        for (int w = 0; w < nways; w++) {
+            if (w > 0 && !ways[w].fn) {
+                printf(" %10s", "-");
+                continue;
+            }
+            double ns = bench_run(&d, k, ways[w].fn, &sum);
+            if (w == 0) want = sum;
+            printf(" %10.1f%s", ns, sum == want ? "" : "!");
+        }
+        printf("\n");
+        free(d.buf);
+    }
+    return 0;
+}
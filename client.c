@@ -13,10 +13,84 @@
 #define PORT 9090
 #define BUFSZ 256
 
-int main() {
+/* Read exactly n bytes; 0 on EOF or error */
+static int read_full(int fd, void *buf, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = read(fd, (char *)buf + got, n - got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return 0;
+        got += r;
+    }
+    return 1;
+}
+
+/* ------------------------------------------------------------
+   Framed mode (client --framed): print FRAME_TEXT payloads as
+   they come and read a line from the user at each FRAME_PROMPT,
+   so output is never mistaken for a prompt however TCP splits or
+   merges it.
+   ------------------------------------------------------------ */
+static void framed_session(int sockfd) {
+    unsigned char hdr[FRAME_HEADER];
+    FrameHeader h;
+    char input[BUFSZ];
+    unsigned int next_id = 1;
+    size_t cap = 0;
+    char *payload = NULL;
+
+    if (frame_send(sockfd, FRAME_HELLO, 0, NULL, 0) == -1) {
+        perror("send");
+        return;
+    }
+
+    // The server sends its first prompt as text before it reads the
+    // hello; show it, then everything is frames from its reply on
+    for (;;) {
+        if (!read_full(sockfd, hdr, 1)) return;
+        if (hdr[0] == FRAME_MAGIC0) break;
+        putchar(hdr[0]);
+    }
+    if (!read_full(sockfd, hdr + 1, FRAME_HEADER - 1) ||
+        frame_parse_header(hdr, &h) == -1 || h.type != FRAME_HELLO || h.len != 0) {
+        fprintf(stderr, "Server does not speak the framed protocol\n");
+        return;
+    }
+
+    while (read_full(sockfd, hdr, FRAME_HEADER)) {
+        if (frame_parse_header(hdr, &h) == -1) {
+            fprintf(stderr, "Malformed frame from server\n");
+            break;
+        }
+        if (h.len > cap) {
+            free(payload);
+            cap = h.len;
+            if (!(payload = malloc(cap))) break;
+        }
+        if (h.len > 0 && !read_full(sockfd, payload, h.len)) break;
+
+        if (h.type == FRAME_TEXT) {
+            fwrite(payload, 1, h.len, stdout);
+        } else if (h.type == FRAME_PROMPT) {
+            fflush(stdout);
+            if (!fgets(input, sizeof(input), stdin))
+                break;
+            trim_newline(input);
+            if (frame_send(sockfd, FRAME_ANSWER, next_id++, input, strlen(input)) == -1)
+                break;
+            if (strstr(input, "exit") != NULL || strstr(input, "quit") != NULL)
+                break;
+        }
+    }
+    free(payload);
+}
+
+/* Usage: client [--framed] */
+int main(int argc, char **argv) {
     int sockfd;
     struct sockaddr_in servaddr;
     char buffer[BUFSZ];
+    int framed = argc > 1 && strcmp(argv[1], "--framed") == 0;
 
     // Create socket
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -39,6 +113,13 @@ int main() {
 
     printf("Connected to server on port %d\n", PORT);
 
+    if (framed) {
+        framed_session(sockfd);
+        printf("Disconnected.\n");
+        close(sockfd);
+        return 0;
+    }
+
     // Interactive login process
     while (1) {
         // Receive message from server
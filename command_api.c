@@ -0,0 +1,382 @@
+/* command_api.c
+   One-shot command interface: one line in, one line out, no menus.
+
+   A connection whose first input starts with a command verb is
+   served here instead of by the login prompt:
+
+       AUTH <role> <username> <password>      -> OK <token>
+       BALANCE <token> <user>                 -> OK <balance>
+       DEPOSIT <token> <user> <amount>        -> OK <new balance>
+       WITHDRAW <token> <user> <amount>       -> OK <new balance>
+       TRANSFER <token> <from> <to> <amount>  -> OK <new balance of from>
+       LOGOUT <token>                         -> OK
+       QUIT                                   -> OK, then the server closes
+
+   Every command gets exactly one reply line, "OK ..." or
+   "ERR <reason>"; the login greeting sent before the first command
+   is ended with a newline, so a script can skip every line that is
+   neither. A line may start with a request id, "#<id> DEPOSIT ...",
+   and its reply then starts with "#<id> " too; over the framed
+   protocol the frame's request id is used instead.
+
+   Pipelining: commands may be sent back to back without waiting.
+   Whatever has already arrived runs in order as one batch: money
+   commands log their WAL records without waiting, the batch then
+   waits for one WAL commit covering all of them, and the replies
+   go out together once the connection has no more input. So N
+   pipelined deposits cost about one fsync and one write per batch
+   instead of N of each; a reply still only says OK once durable.
+   A token comes from AUTH (session_api_begin(), session.c) and is
+   good on any connection until LOGOUT or SESSION_API_IDLE seconds
+   unused. Money commands run the same code as the customer menu and
+   keep its rule: customers act on their own account only.
+   Designed to be included directly into server.c (no header).
+*/
+
+#include "utils.h"
+#include "Struct.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <semaphore.h>
+
+#define API_LINE_MAX   512                // longest command line
+#define API_MAX_ARGS   5
+#define API_BATCH      128                // replies held for one WAL commit
+#define API_INPUT_BUF  65536              // text input read per receive
+
+typedef struct {
+    int slot;                        // token session
+    int role;
+    char username[64];
+} ApiCaller;
+
+typedef struct {
+    unsigned int id;                 // request id
+    int tagged;                      // text line had "#<id>"
+    WalRecord rec;                   // change to commit; rec.lsn 0 = none
+    char text[96];
+} ApiReply;
+
+typedef struct {
+    int connfd;
+    int n;
+    uint64_t lsn;                    // highest lsn among the replies
+    ApiReply reply[API_BATCH];
+} ApiBatch;
+
+typedef struct {
+    const char *verb;
+    int nargs;                       // arguments after the verb (token included)
+    int needs_token;                 // argv[1] is a token
+    void (*run)(ApiReply *r, const ApiCaller *caller, char **argv);
+} ApiCommand;
+
+static void api_reply(ApiReply *r, const char *fmt, double value) {
+    snprintf(r->text, sizeof(r->text), fmt, value);
+}
+
+static void api_text(ApiReply *r, const char *text) {
+    snprintf(r->text, sizeof(r->text), "%s", text);
+}
+
+/* Whole positive number that fits an int, as the menus accept */
+static int api_amount(const char *s, int *out) {
+    char *end;
+    long v = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || v <= 0 || v > INT_MAX) return -1;
+    *out = (int)v;
+    return 0;
+}
+
+/* Customers may only move money on their own account */
+static int api_owns(ApiReply *r, const ApiCaller *caller, const char *user) {
+    if (caller->role == ROLE_CUSTOMER && strcmp(caller->username, user) == 0)
+        return 1;
+    api_text(r, "ERR permission denied\n");
+    return 0;
+}
+
+static void api_money_reply(ApiReply *r, MoneyStatus st, double new_balance) {
+    switch (st) {
+    case MONEY_OK:           api_reply(r, "OK %.0f\n", new_balance); break;
+    case MONEY_NO_ACCOUNT:   api_text(r, "ERR account not found\n"); break;
+    case MONEY_NO_RECEIVER:  api_text(r, "ERR receiver not found\n"); break;
+    case MONEY_SAME_ACCOUNT: api_text(r, "ERR same account\n"); break;
+    case MONEY_LOCK_FAILED:  api_text(r, "ERR cannot lock account\n"); break;
+    case MONEY_INSUFFICIENT: api_text(r, "ERR insufficient balance\n"); break;
+    default:                 api_text(r, "ERR update failed\n"); break;
+    }
+}
+
+static void api_auth(ApiReply *r, const ApiCaller *caller, char **argv) {
+    (void)caller;
+    const char *filename;
+    int role;
+    if      (strcmp(argv[1], "admin")    == 0) { filename = "admin.txt";    role = ROLE_ADMIN; }
+    else if (strcmp(argv[1], "manager")  == 0) { filename = "manager.txt";  role = ROLE_MANAGER; }
+    else if (strcmp(argv[1], "employee") == 0) { filename = "employee.txt"; role = ROLE_EMPLOYEE; }
+    else if (strcmp(argv[1], "customer") == 0) { filename = "customer.txt"; role = ROLE_CUSTOMER; }
+    else {
+        api_text(r, "ERR invalid role\n");
+        return;
+    }
+
+    char token[64];
+    int slot = 0;
+    sem_wait(sem_userdb);
+    int valid = userdir_authenticate(filename, argv[2], argv[3]);
+    if (valid == 1) slot = session_api_begin(role, argv[2], token, sizeof(token));
+    sem_post(sem_userdb);
+
+    if (valid != 1)
+        api_text(r, "ERR invalid credentials\n");
+    else if (slot == SESSION_TAKEN)
+        api_text(r, "ERR already logged in\n");
+    else if (slot < 0)
+        api_text(r, "ERR server busy\n");
+    else {
+        snprintf(r->text, sizeof(r->text), "OK %s\n", token);
+    }
+}
+
+static void api_logout(ApiReply *r, const ApiCaller *caller, char **argv) {
+    (void)argv;
+    sem_wait(sem_userdb);
+    session_api_end(caller->slot);
+    sem_post(sem_userdb);
+    api_text(r, "OK\n");
+}
+
+static void api_balance(ApiReply *r, const ApiCaller *caller, char **argv) {
+    if (!api_owns(r, caller, argv[2])) return;
+    int slot = account_table_find(argv[2]);
+    if (slot < 0) {
+        api_text(r, "ERR account not found\n");
+        return;
+    }
+    api_reply(r, "OK %.0f\n", account_table_get(slot)->balance);
+}
+
+static void api_deposit(ApiReply *r, const ApiCaller *caller, char **argv) {
+    int amount;
+    double balance = 0;
+    if (!api_owns(r, caller, argv[2])) return;
+    if (api_amount(argv[3], &amount) == -1) {
+        api_text(r, "ERR invalid amount\n");
+        return;
+    }
+    MoneyStatus st = money_deposit(argv[2], amount, &balance, &r->rec);
+    api_money_reply(r, st, balance);
+}
+
+static void api_withdraw(ApiReply *r, const ApiCaller *caller, char **argv) {
+    int amount;
+    double balance = 0;
+    if (!api_owns(r, caller, argv[2])) return;
+    if (api_amount(argv[3], &amount) == -1) {
+        api_text(r, "ERR invalid amount\n");
+        return;
+    }
+    MoneyStatus st = money_withdraw(argv[2], amount, &balance, &r->rec);
+    api_money_reply(r, st, balance);
+}
+
+static void api_transfer(ApiReply *r, const ApiCaller *caller, char **argv) {
+    int amount;
+    double balance = 0;
+    if (!api_owns(r, caller, argv[2])) return;
+    if (api_amount(argv[4], &amount) == -1) {
+        api_text(r, "ERR invalid amount\n");
+        return;
+    }
+    if (strcmp(argv[2], argv[3]) == 0) {
+        api_text(r, "ERR same account\n");
+        return;
+    }
+    MoneyStatus st = money_transfer(argv[2], argv[3], amount, &balance, &r->rec);
+    api_money_reply(r, st, balance);
+}
+
+static const ApiCommand api_commands[] = {
+    { "AUTH",     3, 0, api_auth },
+    { "LOGOUT",   1, 1, api_logout },
+    { "BALANCE",  2, 1, api_balance },
+    { "DEPOSIT",  3, 1, api_deposit },
+    { "WITHDRAW", 3, 1, api_withdraw },
+    { "TRANSFER", 4, 1, api_transfer },
+    { "QUIT",     0, 0, NULL },
+};
+#define API_COMMANDS ((int)(sizeof(api_commands) / sizeof(api_commands[0])))
+
+static const ApiCommand *api_lookup(const char *verb, size_t len) {
+    for (int i = 0; i < API_COMMANDS; i++)
+        if (strlen(api_commands[i].verb) == len && memcmp(api_commands[i].verb, verb, len) == 0)
+            return &api_commands[i];
+    return NULL;
+}
+
+/* Does this first input from a client start with a command verb
+   (after an optional "#<id>" tag)? */
+int command_is_api(const char *input) {
+    if (input[0] == '#') {
+        input += strcspn(input, " \r\n");
+        input += strspn(input, " ");
+    }
+    size_t len = strcspn(input, " \r\n");
+    return api_lookup(input, len) != NULL;
+}
+
+/* Wait for the batch's WAL records, then hand its replies to the
+   connection (held there until it runs out of input). If the log
+   failed, each change that did not make it is undone and its reply
+   becomes an error; those before the failure stand. */
+static void api_commit(ApiBatch *b) {
+    int failed = b->lsn != 0 && wal_commit(b->lsn) == -1;
+    for (int i = 0; i < b->n; i++) {
+        ApiReply *r = &b->reply[i];
+        if (failed && r->rec.lsn != 0 && wal_commit(r->rec.lsn) == -1) {
+            money_undo(&r->rec);
+            api_text(r, "ERR update failed\n");
+        }
+        if (r->tagged) {
+            char msg[sizeof(r->text) + 16];
+            snprintf(msg, sizeof(msg), "#%u %s", r->id, r->text);
+            send_message_id(b->connfd, r->id, msg);
+        } else {
+            send_message_id(b->connfd, r->id, r->text);
+        }
+    }
+    b->n = 0;
+    b->lsn = 0;
+}
+
+/* Run one command line into the batch. 'id' is the framed request
+   id (text lines may carry their own). Returns 1 after QUIT. */
+static int api_run_line(ApiBatch *b, char *line, unsigned int id) {
+    char *argv[API_MAX_ARGS + 1], *save;
+    int argc = 0, tagged = 0;
+    char *tok = strtok_r(line, " \r", &save);
+    if (!tok) return 0;                          // blank line
+    if (tok[0] == '#') {                         // "#<id>" request tag
+        char *end;
+        unsigned long v = strtoul(tok + 1, &end, 10);
+        if (end == tok + 1 || *end != '\0' || v > 0xffffffffUL) v = 0;
+        id = (unsigned int)v;
+        tagged = 1;
+        tok = strtok_r(NULL, " \r", &save);
+    }
+
+    if (b->n == API_BATCH) api_commit(b);
+    ApiReply *r = &b->reply[b->n++];
+    r->id = id;
+    r->tagged = tagged;
+    r->rec.lsn = 0;
+
+    for (; tok; tok = strtok_r(NULL, " \r", &save)) {
+        if (argc == API_MAX_ARGS + 1) {
+            api_text(r, "ERR wrong number of arguments\n");
+            return 0;
+        }
+        argv[argc++] = tok;
+    }
+    if (argc == 0) {
+        api_text(r, "ERR unknown command\n");
+        return 0;
+    }
+
+    const ApiCommand *cmd = api_lookup(argv[0], strlen(argv[0]));
+    if (!cmd) {
+        api_text(r, "ERR unknown command\n");
+        return 0;
+    }
+    if (argc != cmd->nargs + 1) {
+        api_text(r, "ERR wrong number of arguments\n");
+        return 0;
+    }
+    if (!cmd->run) {
+        api_text(r, "OK\n");
+        return 1;
+    }
+
+    ApiCaller caller = { -1, 0, "" };
+    if (cmd->needs_token) {
+        sem_wait(sem_userdb);
+        caller.slot = session_api_find(argv[1], &caller.role, caller.username, sizeof(caller.username));
+        sem_post(sem_userdb);
+        if (caller.slot < 0) {
+            api_text(r, "ERR invalid token\n");
+            return 0;
+        }
+    }
+    cmd->run(r, &caller, argv);
+    if (r->rec.lsn > b->lsn) b->lsn = r->rec.lsn;
+    return 0;
+}
+
+/* A framed answer is one whole command line */
+static void api_framed_session(ApiBatch *b, const char *first) {
+    char line[API_LINE_MAX];
+    snprintf(line, sizeof(line), "%s", first);
+    for (;;) {
+        if (api_run_line(b, line, message_request_id(b->connfd))) return;
+        if (!message_pending(b->connfd)) api_commit(b);      // about to wait for input
+        if (receive_message(b->connfd, line, sizeof(line)) <= 0) return;
+    }
+}
+
+/* Text input is split on '\n'; one receive may carry many lines */
+static void api_text_session(ApiBatch *b, const char *first) {
+    char *pending = malloc(API_INPUT_BUF);
+    if (!pending) return;
+    size_t len = strlen(first);
+    memcpy(pending, first, len);
+
+    send_message(b->connfd, "\n");               // ends the greeting line
+    for (;;) {
+        char *line = pending, *nl;
+        while ((nl = memchr(line, '\n', len - (line - pending))) != NULL) {
+            *nl = '\0';
+            if (api_run_line(b, line, 0)) goto out;
+            line = nl + 1;
+        }
+        len -= line - pending;
+        memmove(pending, line, len);
+        api_commit(b);
+        if (len >= API_LINE_MAX) {
+            send_message(b->connfd, "ERR line too long\n");
+            goto out;
+        }
+
+        if (receive_message(b->connfd, pending + len, API_INPUT_BUF - len) <= 0) {
+            if (len > 0) {                       // last line without '\n'
+                pending[len] = '\0';
+                api_run_line(b, pending, 0);
+            }
+            goto out;
+        }
+        len += strlen(pending + len);
+    }
+out:
+    free(pending);
+}
+
+/* ------------------------------------------------------------
+   Serve a command connection until QUIT or disconnect. 'first' is
+   the client's first input, as received.
+   ------------------------------------------------------------ */
+void command_session(int connfd, const char *first) {
+    ApiBatch *b = malloc(sizeof(ApiBatch));
+    if (!b) return;
+    b->connfd = connfd;
+    b->n = 0;
+    b->lsn = 0;
+
+    message_set_buffered(connfd, 1);
+    if (message_conn_framed(connfd)) api_framed_session(b, first);
+    else api_text_session(b, first);
+    api_commit(b);
+    message_set_buffered(connfd, 0);
+    free(b);
+}
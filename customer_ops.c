@@ -13,59 +13,162 @@
 extern sem_t *sem_userdb;
 extern sem_t *sem_account;
 extern sem_t *sem_loan;
+extern sem_t *sem_ledger;
 
 
 void view_balance(int connfd, const char *username) {
-    int fd;
-    char buf[512], line[256];
-    ssize_t r;
-    int pos = 0;
-    int found = 0;
-
-    sem_wait(sem_account);  // Lock account file while reading
-
-    fd = open("account_db.txt", O_RDONLY);
-    if (fd == -1) {
-        sem_post(sem_account);
-        send_message(connfd, "Error: cannot open account_db.txt\n");
+    // Pure memory lookup in the shared table; an aligned double is
+    // read atomically, so no lock is needed for a single balance.
+    int slot = account_table_find(username);
+    if (slot < 0) {
+        send_message(connfd, "Error: Account not found.\n");
         return;
     }
 
-    // Read line-by-line manually using system calls
-    while ((r = read(fd, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < r; ++i) {
-            if (buf[i] == '\n' || pos >= (int)sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-
-                if (line[0] != '\0') {
-                    int acc_id, balance;
-                    char user[64];
-
-                    // Parse one line: id username balance
-                    if (sscanf(line, "%d %s %d", &acc_id, user, &balance) == 3) {
-                        if (strcmp(user, username) == 0) {
-                            found = 1;
-                            char msg[128];
-                            int len = snprintf(msg, sizeof(msg),
-                                "\nYour current account balance: ₹%d\n", balance);
-                            write(connfd, msg, len);
-                            break;
-                        }
-                    }
-                }
-            } else {
-                line[pos++] = buf[i];
-            }
-        }
-        if (found) break;  // Stop reading once found
+    char msg[128];
+    snprintf(msg, sizeof(msg),
+        "\nYour current account balance: ₹%.0f\n", account_table_get(slot)->balance);
+    send_message(connfd, msg);
+}
+
+/* ------------------------------------------------------------
+   Money operations without the prompts, shared by the customer
+   menu and the command API (command_api.c). Each returns MONEY_OK
+   and the new balance of 'username' (the sender for a transfer),
+   or what went wrong; nothing stays locked either way.
+   A change whose WAL record is not made durable is taken back out
+   of the account table, so a failure really means "not done".
+   With 'defer' set, the operation does not wait for its WAL
+   record: the record is copied there and the caller must
+   wal_commit() its lsn before reporting success, and money_undo()
+   it if that fails (the API commits a batch at once).
+   ------------------------------------------------------------ */
+typedef enum {
+    MONEY_OK,
+    MONEY_NO_ACCOUNT,                // 'username' has no account
+    MONEY_NO_RECEIVER,
+    MONEY_SAME_ACCOUNT,
+    MONEY_LOCK_FAILED,
+    MONEY_INSUFFICIENT,
+    MONEY_IO_FAILED                  // not logged durably: not done
+} MoneyStatus;
+
+/* Take back the change of a logged operation whose commit failed */
+void money_undo(const WalRecord *rec) {
+    int a = rec->slot[0], b = rec->nacc == 2 ? rec->slot[1] : -1;
+    int locked = (b >= 0 ? account_lock_pair(a, b) : account_lock(a)) == 0;
+    if (!locked) perror("money_undo: account lock");
+
+    if (rec->type == WAL_DEPOSIT) {
+        account_table_get(a)->balance -= rec->amount;
+    } else if (rec->type == WAL_WITHDRAW) {
+        account_table_get(a)->balance += rec->amount;
+    } else {
+        account_table_get(a)->balance += rec->amount;
+        account_table_get(b)->balance -= rec->amount;
+    }
+
+    if (!locked) return;
+    if (b >= 0) account_unlock_pair(a, b);
+    else account_unlock(a);
+}
+
+static MoneyStatus money_commit(const WalRecord *rec, WalRecord *defer) {
+    if (defer) {
+        *defer = *rec;
+        return MONEY_OK;
+    }
+    if (wal_commit(rec->lsn) == -1) {
+        money_undo(rec);
+        return MONEY_IO_FAILED;
     }
+    return MONEY_OK;
+}
+
+MoneyStatus money_deposit(const char *username, int amount, double *new_balance,
+                          WalRecord *defer) {
+    int slot = account_table_find(username);
+    if (slot < 0) return MONEY_NO_ACCOUNT;
+
+    if (account_lock(slot) == -1)    // lock only this account
+        return MONEY_LOCK_FAILED;
+
+    // Update in memory and log the new balance with its ledger row;
+    // this is the only time the operation holds the account lock
+    CustomerAccount *acc = account_table_get(slot);
+    acc->balance += amount;
+    *new_balance = acc->balance;
+    WalRecord rec;
+    uint64_t lsn = wal_log_balances(WAL_DEPOSIT, amount, slot, -1, &rec);
+    if (lsn == 0) acc->balance -= amount;    // not logged: not done
+
+    account_unlock(slot);
+    if (lsn == 0) return MONEY_IO_FAILED;
+
+    // Acknowledge only once the WAL record is durable (group commit);
+    // the commit also writes the balance back and appends the ledger row
+    return money_commit(&rec, defer);
+}
 
-    close(fd);
-    sem_post(sem_account);  // Unlock file
+MoneyStatus money_withdraw(const char *username, int amount, double *new_balance,
+                           WalRecord *defer) {
+    int slot = account_table_find(username);
+    if (slot < 0) return MONEY_NO_ACCOUNT;
 
-    if (!found)
-        send_message(connfd, "Error: Account not found.\n");
+    if (account_lock(slot) == -1) return MONEY_LOCK_FAILED;
+
+    CustomerAccount *acc = account_table_get(slot);
+    if (amount > acc->balance) {
+        account_unlock(slot);
+        return MONEY_INSUFFICIENT;
+    }
+
+    acc->balance -= amount;
+    *new_balance = acc->balance;
+    WalRecord rec;
+    uint64_t lsn = wal_log_balances(WAL_WITHDRAW, amount, slot, -1, &rec);
+    if (lsn == 0) acc->balance += amount;
+
+    account_unlock(slot);
+    if (lsn == 0) return MONEY_IO_FAILED;
+
+    return money_commit(&rec, defer);
+}
+
+MoneyStatus money_transfer(const char *username, const char *receiver, int amount,
+                           double *new_balance, WalRecord *defer) {
+    int s_slot = account_table_find(username);
+    if (s_slot < 0) return MONEY_NO_ACCOUNT;
+
+    int r_slot = account_table_find(receiver);
+    if (r_slot < 0) return MONEY_NO_RECEIVER;
+    if (r_slot == s_slot) return MONEY_SAME_ACCOUNT;
+
+    // Both accounts, always in slot order (deadlock-free)
+    if (account_lock_pair(s_slot, r_slot) == -1) return MONEY_LOCK_FAILED;
+
+    CustomerAccount *sender = account_table_get(s_slot);
+    CustomerAccount *recv = account_table_get(r_slot);
+    if (sender->balance < amount) {
+        account_unlock_pair(s_slot, r_slot);
+        return MONEY_INSUFFICIENT;
+    }
+
+    // --- Update both records in memory; one WAL record covers both ---
+    sender->balance -= amount;
+    recv->balance += amount;
+    *new_balance = sender->balance;
+    WalRecord rec;
+    uint64_t lsn = wal_log_balances(WAL_TRANSFER, amount, s_slot, r_slot, &rec);
+    if (lsn == 0) {
+        sender->balance += amount;
+        recv->balance -= amount;
+    }
+
+    account_unlock_pair(s_slot, r_slot);
+    if (lsn == 0) return MONEY_IO_FAILED;
+
+    return money_commit(&rec, defer);
 }
 
 void deposit_money(int connfd, const char *username) {
@@ -82,98 +185,26 @@ void deposit_money(int connfd, const char *username) {
         return;
     }
 
-    sem_wait(sem_account); // lock account file
-    int fd_old = open("account_db.txt", O_RDONLY);
-    if (fd_old == -1) {
-        sem_post(sem_account);
-        send_message(connfd, "Error: cannot open account_db.txt\n");
+    double new_balance;
+    switch (money_deposit(username, amount, &new_balance, NULL)) {
+    case MONEY_OK:
+        break;
+    case MONEY_NO_ACCOUNT:
+        send_message(connfd, "Error: Account not found.\n");
         return;
-    }
-
-    int fd_new = open("temp_account.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_new == -1) {
-        close(fd_old);
-        sem_post(sem_account);
-        send_message(connfd, "Error: cannot create temp file.\n");
+    case MONEY_LOCK_FAILED:
+        send_message(connfd, "Error: cannot lock account.\n");
         return;
-    }
-
-    char buf[512], line[256];
-    ssize_t r;
-    int pos = 0, found = 0;
-    int new_balance = 0;
-
-    // Read each account record and update target user's balance
-    while ((r = read(fd_old, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < r; ++i) {
-            if (buf[i] == '\n' || pos >= (int)sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-                if (line[0] != '\0') {
-                    int acc_id, balance;
-                    char user[64];
-                    if (sscanf(line, "%d %s %d", &acc_id, user, &balance) == 3) {
-                        if (strcmp(user, username) == 0) {
-                            found = 1;
-                            new_balance = balance + amount;
-                            char newline[128];
-                            int len = snprintf(newline, sizeof(newline),
-                                "%d %s %d\n", acc_id, user, new_balance);
-                            write(fd_new, newline, len);
-                        } else {
-                            write(fd_new, line, strlen(line));
-                            write(fd_new, "\n", 1);
-                        }
-                    }
-                }
-            } else {
-                line[pos++] = buf[i];
-            }
-        }
-    }
-
-    close(fd_old);
-    close(fd_new);
-
-    if (!found) {
-        unlink("temp_account.txt");
-        sem_post(sem_account);
-        send_message(connfd, "Error: Account not found.\n");
+    default:
+        send_message(connfd, "Error: failed to update account.\n");
         return;
     }
 
-    rename("temp_account.txt", "account_db.txt");
-    sem_post(sem_account);
-
     // Send confirmation
     char msg[128];
-    int len = snprintf(msg, sizeof(msg),
-        "Deposit successful! New balance: ₹%d\n", new_balance);
-    write(connfd, msg, len);
-
-    /* ---------- Transaction Logging ---------- */
-    sem_wait(sem_account);
-    int fd_txn = open("transactions_db.txt", O_WRONLY | O_APPEND | O_CREAT, 0644);
-    if (fd_txn != -1) {
-        int txn_id = get_next_id("transactions_db.txt");
-
-        // Generate simple timestamp
-        time_t now = time(NULL);
-        struct tm *t = localtime(&now);
-        char ts[64];
-        snprintf(ts, sizeof(ts), "%04d-%02d-%02d_%02d:%02d:%02d",
-                 t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-                 t->tm_hour, t->tm_min, t->tm_sec);
-
-        char log_entry[256];
-        int log_len = snprintf(log_entry, sizeof(log_entry),
-            "%d %s deposit %d %s %d\n",
-            txn_id, username, amount, ts, new_balance);
-
-        write(fd_txn, log_entry, log_len);
-        close(fd_txn);
-    }
-    sem_post(sem_account);
+    snprintf(msg, sizeof(msg),
+        "Deposit successful! New balance: ₹%.0f\n", new_balance);
+    send_message(connfd, msg);
 }
 
 void withdraw_money(int connfd, const char *username) {
@@ -190,107 +221,28 @@ void withdraw_money(int connfd, const char *username) {
         return;
     }
 
-    sem_wait(sem_account);
-    int fd_old = open("account_db.txt", O_RDONLY);
-    if (fd_old == -1) {
-        sem_post(sem_account);
-        send_message(connfd, "Error: cannot open account_db.txt\n");
+    double new_balance;
+    switch (money_withdraw(username, amount, &new_balance, NULL)) {
+    case MONEY_OK:
+        break;
+    case MONEY_NO_ACCOUNT:
+        send_message(connfd, "Error: Account not found.\n");
         return;
-    }
-
-    int fd_new = open("temp_account.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_new == -1) {
-        close(fd_old);
-        sem_post(sem_account);
-        send_message(connfd, "Error: cannot create temp_account.txt\n");
+    case MONEY_LOCK_FAILED:
+        send_message(connfd, "Error: cannot lock account.\n");
         return;
-    }
-
-    char buf[512], line[256];
-    ssize_t r;
-    int pos = 0, found = 0;
-    int new_balance = 0, current_balance = 0;
-
-    while ((r = read(fd_old, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < r; ++i) {
-            if (buf[i] == '\n' || pos >= (int)sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-
-                if (line[0] != '\0') {
-                    int acc_id, balance;
-                    char user[64];
-                    if (sscanf(line, "%d %s %d", &acc_id, user, &balance) == 3) {
-                        if (strcmp(user, username) == 0) {
-                            found = 1;
-                            current_balance = balance;
-
-                            if (amount > balance) {
-                                close(fd_old);
-                                close(fd_new);
-                                unlink("temp_account.txt");
-                                sem_post(sem_account);
-                                send_message(connfd, "Insufficient balance.\n");
-                                return;
-                            }
-
-                            new_balance = balance - amount;
-                            char newline[128];
-                            int len = snprintf(newline, sizeof(newline),
-                                "%d %s %d\n", acc_id, user, new_balance);
-                            write(fd_new, newline, len);
-                        } else {
-                            write(fd_new, line, strlen(line));
-                            write(fd_new, "\n", 1);
-                        }
-                    }
-                }
-            } else {
-                line[pos++] = buf[i];
-            }
-        }
-    }
-
-    close(fd_old);
-    close(fd_new);
-
-    if (!found) {
-        unlink("temp_account.txt");
-        sem_post(sem_account);
-        send_message(connfd, "Error: Account not found.\n");
+    case MONEY_INSUFFICIENT:
+        send_message(connfd, "Insufficient balance.\n");
+        return;
+    default:
+        send_message(connfd, "Error: failed to update account.\n");
         return;
     }
 
-    rename("temp_account.txt", "account_db.txt");
-    sem_post(sem_account);
-
     char msg[128];
-    int len = snprintf(msg, sizeof(msg),
-        "Withdrawal successful! New balance: ₹%d\n", new_balance);
-    write(connfd, msg, len);
-
-    /* ---------- Transaction Logging ---------- */
-    sem_wait(sem_account);
-    int fd_txn = open("transactions_db.txt", O_WRONLY | O_APPEND | O_CREAT, 0644);
-    if (fd_txn != -1) {
-        int txn_id = get_next_id("transactions_db.txt");
-
-        time_t now = time(NULL);
-        struct tm *t = localtime(&now);
-        char ts[64];
-        snprintf(ts, sizeof(ts), "%04d-%02d-%02d_%02d:%02d:%02d",
-                 t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-                 t->tm_hour, t->tm_min, t->tm_sec);
-
-        char log_entry[256];
-        int log_len = snprintf(log_entry, sizeof(log_entry),
-            "%d %s withdraw %d %s %d\n",
-            txn_id, username, amount, ts, new_balance);
-
-        write(fd_txn, log_entry, log_len);
-        close(fd_txn);
-    }
-    sem_post(sem_account);
+    snprintf(msg, sizeof(msg),
+        "Withdrawal successful! New balance: ₹%.0f\n", new_balance);
+    send_message(connfd, msg);
 }
 
 void transfer_funds(int connfd, const char *username) {
@@ -316,132 +268,35 @@ void transfer_funds(int connfd, const char *username) {
         return;
     }
 
-    sem_wait(sem_account);
-
-    int fd_old = open("account_db.txt", O_RDONLY);
-    if (fd_old == -1) {
-        sem_post(sem_account);
-        send_message(connfd, "Error: cannot open account_db.txt\n");
-        return;
-    }
-
-    int fd_new = open("temp_account.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_new == -1) {
-        close(fd_old);
-        sem_post(sem_account);
-        send_message(connfd, "Error: cannot create temp_account.txt\n");
-        return;
-    }
-
-    char buf[512], line[256];
-    ssize_t r;
-    int pos = 0;
-    int found_sender = 0, found_receiver = 0;
-    int sender_balance = 0, receiver_balance = 0;
-    int new_sender_balance = 0, new_receiver_balance = 0;
-
-    // --- Read & update both accounts ---
-    while ((r = read(fd_old, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < r; ++i) {
-            if (buf[i] == '\n' || pos >= (int)sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-                if (line[0] != '\0') {
-                    int acc_id, balance;
-                    char user[64];
-                    if (sscanf(line, "%d %s %d", &acc_id, user, &balance) == 3) {
-                        if (strcmp(user, username) == 0) {
-                            found_sender = 1;
-                            sender_balance = balance;
-
-                            if (balance < amount) {
-                                close(fd_old);
-                                close(fd_new);
-                                unlink("temp_account.txt");
-                                sem_post(sem_account);
-                                send_message(connfd, "❌ Insufficient balance.\n");
-                                return;
-                            }
-
-                            new_sender_balance = balance - amount;
-                            char newline[128];
-                            int len = snprintf(newline, sizeof(newline),
-                                "%d %s %d\n", acc_id, user, new_sender_balance);
-                            write(fd_new, newline, len);
-                        } 
-                        else if (strcmp(user, receiver) == 0) {
-                            found_receiver = 1;
-                            receiver_balance = balance;
-                            new_receiver_balance = balance + amount;
-                            char newline[128];
-                            int len = snprintf(newline, sizeof(newline),
-                                "%d %s %d\n", acc_id, user, new_receiver_balance);
-                            write(fd_new, newline, len);
-                        } 
-                        else {
-                            write(fd_new, line, strlen(line));
-                            write(fd_new, "\n", 1);
-                        }
-                    }
-                }
-            } else {
-                line[pos++] = buf[i];
-            }
-        }
-    }
-
-    close(fd_old);
-    close(fd_new);
-
-    if (!found_sender) {
-        unlink("temp_account.txt");
-        sem_post(sem_account);
+    double new_sender_balance;
+    switch (money_transfer(username, receiver, amount, &new_sender_balance, NULL)) {
+    case MONEY_OK:
+        break;
+    case MONEY_NO_ACCOUNT:
         send_message(connfd, "Error: Your account not found.\n");
         return;
-    }
-
-    if (!found_receiver) {
-        unlink("temp_account.txt");
-        sem_post(sem_account);
+    case MONEY_NO_RECEIVER:
         send_message(connfd, "Error: Receiver account not found.\n");
         return;
+    case MONEY_SAME_ACCOUNT:
+        send_message(connfd, "Error: Cannot transfer to your own account.\n");
+        return;
+    case MONEY_LOCK_FAILED:
+        send_message(connfd, "Error: cannot lock accounts.\n");
+        return;
+    case MONEY_INSUFFICIENT:
+        send_message(connfd, "❌ Insufficient balance.\n");
+        return;
+    default:
+        send_message(connfd, "Error: failed to update accounts.\n");
+        return;
     }
 
-    rename("temp_account.txt", "account_db.txt");
-    sem_post(sem_account);
-
     // Notify sender
     char msg[128];
-    int len = snprintf(msg, sizeof(msg),
-        "Transfer successful! New balance: ₹%d\n", new_sender_balance);
-    write(connfd, msg, len);
-
-    /* ---------- Transaction Logging ---------- */
-    sem_wait(sem_account);
-    int fd_txn = open("transactions_db.txt", O_WRONLY | O_APPEND | O_CREAT, 0644);
-    if (fd_txn != -1) {
-        int txn_id = get_next_id("transactions_db.txt");
-
-        time_t now = time(NULL);
-        struct tm *t = localtime(&now);
-        char ts[64];
-        snprintf(ts, sizeof(ts), "%04d-%02d-%02d_%02d:%02d:%02d",
-                 t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-                 t->tm_hour, t->tm_min, t->tm_sec);
-
-        char log1[256], log2[256];
-        int len1 = snprintf(log1, sizeof(log1),
-            "%d %s transfer-out %d %s %d\n",
-            txn_id, username, amount, ts, new_sender_balance);
-        int len2 = snprintf(log2, sizeof(log2),
-            "%d %s transfer-in %d %s %d\n",
-            txn_id + 1, receiver, amount, ts, new_receiver_balance);
-
-        write(fd_txn, log1, len1);
-        write(fd_txn, log2, len2);
-        close(fd_txn);
-    }
-    sem_post(sem_account);
+    snprintf(msg, sizeof(msg),
+        "Transfer successful! New balance: ₹%.0f\n", new_sender_balance);
+    send_message(connfd, msg);
 }
 
 void apply_for_loan(int connfd, const char *username) {
@@ -460,21 +315,26 @@ void apply_for_loan(int connfd, const char *username) {
 
     sem_wait(sem_loan);
 
-    int fd = open("loan_db.txt", O_WRONLY | O_APPEND | O_CREAT, 0644);
-    if (fd == -1) {
+    int loan_id = id_next("loan_db.txt");
+    if (loan_id == -1) {
         sem_post(sem_loan);
-        send_message(connfd, "Error: cannot open loan_db.txt\n");
+        send_message(connfd, "Error: cannot allocate loan ID\n");
         return;
     }
-
-    int loan_id = get_next_id("loan_db.txt");
     if (loan_id < 100) loan_id = 100;  // Start loan IDs from 100
 
-    char entry[256];
-    int len = snprintf(entry, sizeof(entry), "%d %s %d none pending\n",
-                       loan_id, username, amount);
-    write(fd, entry, len);
-    close(fd);
+    Record r;
+    rf_init(&r, 5);
+    rf_set_int(&r, LOAN_ID, loan_id);
+    rf_set_str(&r, LOAN_CUSTOMER, username);
+    rf_set_int(&r, LOAN_AMOUNT, amount);
+    rf_set_str(&r, LOAN_EMPLOYEE, "none");
+    rf_set_str(&r, LOAN_STATUS, "pending");
+    if (rf_append(&rf_loan, &r) == -1) {
+        sem_post(sem_loan);
+        send_message(connfd, "Error: cannot open loan_db.txt\n");
+        return;
+    }
     sem_post(sem_loan);
 
     send_message(connfd, " Loan application submitted successfully! Status: pending\n");
@@ -491,78 +351,19 @@ void change_customer_password(int connfd, const char *username) {
     if (receive_message(connfd, new_pass, sizeof(new_pass)) <= 0) return;
     trim_newline(new_pass);
 
+    int user_seen;
     sem_wait(sem_userdb);
-
-    int fd_old = open("customer.txt", O_RDONLY);
-    if (fd_old == -1) {
-        sem_post(sem_userdb);
-        send_message(connfd, "Error: cannot open customer.txt\n");
-        return;
-    }
-
-    int fd_new = open("temp_customer.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_new == -1) {
-        close(fd_old);
-        sem_post(sem_userdb);
-        send_message(connfd, "Error: cannot create temp_customer.txt\n");
-        return;
-    }
-
-    char buf[512], line[256];
-    ssize_t r;
-    int pos = 0;
-    int found = 0;
-
-    while ((r = read(fd_old, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < r; ++i) {
-            if (buf[i] == '\n' || pos >= (int)sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-                if (line[0] != '\0') {
-                    int id, active;
-                    char user[64], pass[64];
-                    if (sscanf(line, "%d %s %s %d", &id, user, pass, &active) == 4) {
-                        if (strcmp(user, username) == 0) {
-                            if (strcmp(pass, old_pass) != 0) {
-                                close(fd_old);
-                                close(fd_new);
-                                unlink("temp_customer.txt");
-                                sem_post(sem_userdb);
-                                send_message(connfd, "❌ Incorrect old password.\n");
-                                return;
-                            }
-
-                            found = 1;
-                            char newline[256];
-                            int len = snprintf(newline, sizeof(newline),
-                                               "%d %s %s %d\n", id, user, new_pass, active);
-                            write(fd_new, newline, len);
-                        } else {
-                            write(fd_new, line, strlen(line));
-                            write(fd_new, "\n", 1);
-                        }
-                    }
-                }
-            } else {
-                line[pos++] = buf[i];
-            }
-        }
-    }
-
-    close(fd_old);
-    close(fd_new);
-
-    if (!found) {
-        unlink("temp_customer.txt");
-        sem_post(sem_userdb);
-        send_message(connfd, "❌ Customer not found.\n");
-        return;
-    }
-
-    rename("temp_customer.txt", "customer.txt");
+    int n = rf_change_password(&rf_customer, username, old_pass, new_pass, &user_seen);
     sem_post(sem_userdb);
 
-    send_message(connfd, "✅ Password updated successfully.\n");
+    if (n > 0)
+        send_message(connfd, "✅ Password updated successfully.\n");
+    else if (n == -1)
+        send_message(connfd, "Error: cannot update customer.txt\n");
+    else if (user_seen)
+        send_message(connfd, "❌ Incorrect old password.\n");
+    else
+        send_message(connfd, "❌ Customer not found.\n");
 }
 
 
@@ -581,70 +382,148 @@ void add_feedback(int connfd, const char *username) {
 
     sem_wait(sem_userdb);  // 🔒 lock feedback file for safe shared use
 
-    int fd = open("feedback_db.txt", O_WRONLY | O_APPEND | O_CREAT, 0644);
-    if (fd == -1) {
+    // ✅ shared-memory ID sequence instead of rescanning the file
+    int feedback_id = id_next("feedback_db.txt");
+    if (feedback_id == -1) {
         sem_post(sem_userdb);
-        send_message(connfd, "Error: cannot open feedback_db.txt\n");
+        send_message(connfd, "Error: cannot allocate feedback ID\n");
         return;
     }
 
-    // ✅ use global unique ID generator instead of file-local
-    int feedback_id = get_next_global_id("feedback_db.txt");
-
-    char entry[512];
-    int len = snprintf(entry, sizeof(entry), "%d %s %s\n", feedback_id, username, feedback);
-
-    if (write(fd, entry, len) != len) {
-        send_message(connfd, "⚠️ Warning: Failed to write full feedback entry.\n");
+    Record r;
+    rf_init(&r, 3);
+    rf_set_int(&r, FEEDBACK_ID, feedback_id);
+    rf_set_str(&r, FEEDBACK_USER, username);
+    rf_set_str(&r, FEEDBACK_TEXT, feedback);
+    if (rf_append(&rf_feedback, &r) == -1) {
+        sem_post(sem_userdb);
+        send_message(connfd, "Error: cannot write feedback_db.txt\n");
+        return;
     }
 
-    close(fd);
     sem_post(sem_userdb);  // 🔓 unlock after writing
 
     send_message(connfd, "✅ Thank you! Your feedback has been recorded.\n");
 }
 
-void view_transaction_history(int connfd, const char *username) {
-    int fd = open("transactions_db.txt", O_RDONLY | O_CREAT, 0644);
-    if (fd < 0) {
-        send_message(connfd, "Error: Cannot open transaction_db.txt\n");
-        return;
-    }
-
-    sem_wait(sem_account); // protect concurrent access
+/* ledger_scan_user() callback: format one ledger row for the client.
+   ctx is the connection fd. Also used by the employee passbook. */
+static int send_passbook_row(const LedgerRecord *rec, void *ctx) {
+    int connfd = *(int *)ctx;
+    char when[32], msg[512];
+
+    ledger_format_time(rec->timestamp, when, sizeof(when));
+    snprintf(msg, sizeof(msg),
+             "Txn ID: %d | Type: %s | Amount: %.2f | Time: %s | Balance: %.2f\n",
+             rec->tx.tx_id, ledger_type_name(rec->tx.tx_type), rec->tx.amount, when, rec->balance);
+    return send_message(connfd, msg) == -1 ? -1 : 0;
+}
 
-    char line[512];
-    int found = 0;
 
-    while (read_line(fd, line, sizeof(line)) > 0) {
-        if (strlen(line) < 3) continue;
+#define PASSBOOK_PAGE_DEFAULT 10
+#define PASSBOOK_PAGE_MAX     100
 
-        int tx_id;
-        char uname[64], tx_type[32], timestamp[64];
-        double amount, balance;
+/* "YYYY-MM-DD" -> YYYYMMDD, 0 if blank or malformed */
+static int parse_passbook_day(const char *s) {
+    int y, m, d;
+    if (sscanf(s, "%d-%d-%d", &y, &m, &d) != 3 || m < 1 || m > 12 || d < 1 || d > 31)
+        return 0;
+    return y * 10000 + m * 100 + d;
+}
 
-        // Format: <tx_id> <username> <tx_type> <amount> <timestamp> <balance>
-        int parsed = sscanf(line, "%d %63s %31s %lf %63s %lf",
-                            &tx_id, uname, tx_type, &amount, timestamp, &balance);
+/* ------------------------------------------------------------
+   Passbook for 'username', shared by the customer and employee
+   views. Either the full history (oldest first, as before) or
+   pages of newest-first rows, optionally before a Txn ID or within
+   a date range. Each page ends with a cursor token that can be
+   entered later to resume where it stopped.
+   ------------------------------------------------------------ */
+void send_passbook(int connfd, const char *username, const char *empty_msg, const char *end_msg) {
+    char choice_str[8], input[64], msg[128];
+    LedgerCursor cur = { -1, 0, 0, 0 };
+
+    send_message(connfd,
+        "1. Full history\n"
+        "2. Newest transactions first (paged)\n"
+        "3. Before a Txn ID (paged)\n"
+        "4. Date range (paged)\n"
+        "5. Resume from a cursor\n"
+        "Enter choice: ");
+    if (receive_message(connfd, choice_str, sizeof(choice_str)) <= 0) return;
+    int choice = atoi(choice_str);
+
+    if (choice == 1) {
+        // Walk only this user's rows through the ledger index
+        if (ledger_scan_user(username, send_passbook_row, &connfd) > 0)
+            send_message(connfd, end_msg);
+        else
+            send_message(connfd, empty_msg);
+        return;
+    }
+    if (choice < 2 || choice > 5) {
+        send_message(connfd, "Invalid choice.\n");
+        return;
+    }
 
-        if (parsed == 6 && strcmp(uname, username) == 0) {
-            char msg[512];
-            snprintf(msg, sizeof(msg),
-                     "Txn ID: %d | Type: %s | Amount: %.2f | Time: %s | Balance: %.2f\n",
-                     tx_id, tx_type, amount, timestamp, balance);
-            send_message(connfd, msg);
-            found = 1;
+    if (choice == 5) {
+        long long next;
+        send_message(connfd, "Enter cursor: ");
+        if (receive_message(connfd, input, sizeof(input)) <= 0) return;
+        if (sscanf(input, "%lld.%d.%d.%d", &next, &cur.before_tx, &cur.from_day, &cur.to_day) != 4 ||
+            next < 0) {
+            send_message(connfd, "Invalid cursor.\n");
+            return;
         }
+        cur.next = next;
+    } else {
+        ledger_cursor_start(username, &cur);
     }
 
-    sem_post(sem_account);
-    close(fd);
+    if (choice == 3) {
+        send_message(connfd, "Show transactions before Txn ID: ");
+        if (receive_message(connfd, input, sizeof(input)) <= 0) return;
+        if ((cur.before_tx = atoi(input)) <= 0) {
+            send_message(connfd, "Invalid Txn ID.\n");
+            return;
+        }
+    } else if (choice == 4) {
+        send_message(connfd, "From date (YYYY-MM-DD, blank = any): ");
+        if (receive_message(connfd, input, sizeof(input)) <= 0) return;
+        cur.from_day = parse_passbook_day(input);
+        send_message(connfd, "To date (YYYY-MM-DD, blank = any): ");
+        if (receive_message(connfd, input, sizeof(input)) <= 0) return;
+        cur.to_day = parse_passbook_day(input);
+    }
+
+    send_message(connfd, "Transactions per page: ");
+    if (receive_message(connfd, input, sizeof(input)) <= 0) return;
+    int per_page = atoi(input);
+    if (per_page <= 0) per_page = PASSBOOK_PAGE_DEFAULT;
+    if (per_page > PASSBOOK_PAGE_MAX) per_page = PASSBOOK_PAGE_MAX;
+
+    int total = 0;
+    while (1) {
+        int n = ledger_page(username, &cur, per_page, send_passbook_row, &connfd);
+        if (n == -1) {
+            send_message(connfd, "Invalid cursor.\n");
+            return;
+        }
+        total += n;
+        if (cur.next < 0) break;
 
-    if (!found)
-        send_message(connfd, "No transactions found for your account.\n");
-    else
-        send_message(connfd, "---- End of Transaction History ----\n");
+        snprintf(msg, sizeof(msg), "Cursor: %lld.%d.%d.%d\n",
+                 (long long)cur.next, cur.before_tx, cur.from_day, cur.to_day);
+        send_message(connfd, msg);
+        send_message(connfd, "Enter 'n' for the next page, anything else to stop: ");
+        if (receive_message(connfd, input, sizeof(input)) <= 0) return;
+        if (input[0] != 'n' && input[0] != 'N') return;
+    }
+    send_message(connfd, total > 0 ? end_msg : empty_msg);
+}
 
+void view_transaction_history(int connfd, const char *username) {
+    send_passbook(connfd, username, "No transactions found for your account.\n",
+                  "---- End of Transaction History ----\n");
 }
 
 
@@ -679,6 +558,7 @@ void customer_menu(int connfd, const char *username) {
 
         if (receive_message(connfd, choice_str, sizeof(choice_str)) <= 0)
             return;
+        session_touch();
         trim_newline(choice_str);
         choice = atoi(choice_str);
 
@@ -713,9 +593,9 @@ void customer_menu(int connfd, const char *username) {
             case 10:
                 send_message(connfd, "Exiting system...\n");
                 sem_wait(sem_userdb);
-                mark_user_logged_out("customer.txt", username);
+                session_end();
                 sem_post(sem_userdb);
-                _exit(0);
+                client_exit(connfd);
             default:
                 send_message(connfd, "Invalid choice. Try again.\n");
                 break;
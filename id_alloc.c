@@ -0,0 +1,177 @@
+/* id_alloc.c
+   Constant-time ID allocator for the text databases.
+
+   get_next_id() rescans the whole target file for max + 1 on every
+   insert. Here each ID sequence (one per file) is an atomic counter
+   in shared memory; IDs are handed out with a fetch-and-add and only
+   every ID_BLOCK-th allocation touches disk, to reserve the next
+   block in id_tracker.txt ("<key> <highest reserved id>" per line).
+
+   After a restart a sequence resumes past its reserved block, so an
+   ID is never issued twice even if the server died mid-block; the
+   unused rest of that block is simply skipped. A sequence missing
+   from id_tracker.txt is seeded once from its file (and, for
+   feedback, from the old global_id_counter.txt).
+
+   Ledger ids are not allocated here: they are logged with each WAL
+   record and resumed by wal_recover().
+   Designed to be included directly into server.c (no header).
+*/
+
+#include "utils.h"
+#include "Struct.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+
+#define ID_TRACKER_FILE "id_tracker.txt"
+#define ID_TRACKER_TMP  "id_tracker.txt.tmp"
+#define ID_LEGACY_GLOBAL_COUNTER "global_id_counter.txt"
+#define ID_BLOCK        64               // IDs reserved per disk write
+
+typedef struct {
+    const char *key;                 // name in id_tracker.txt
+    const char *file;                // file whose records use the sequence
+} IdSeqInfo;
+
+static const IdSeqInfo id_seqs[] = {
+    { "admin",    "admin.txt" },
+    { "manager",  "manager.txt" },
+    { "employee", "employee.txt" },
+    { "customer", "customer.txt" },
+    { "loan",     "loan_db.txt" },
+    { "feedback", "feedback_db.txt" },
+};
+#define ID_SEQ_COUNT ((int)(sizeof(id_seqs) / sizeof(id_seqs[0])))
+
+typedef struct {
+    int next;                        // next ID to hand out (atomic)
+    int limit;                       // IDs < limit are reserved on disk
+} IdSeq;
+
+typedef struct {
+    sem_t reserve;                   // serializes block reservations
+    IdSeq seq[ID_SEQ_COUNT];
+} IdAllocShared;
+
+static IdAllocShared *id_alloc = NULL;   // mapped by the parent, inherited by children
+
+/* Rewrite id_tracker.txt with every sequence's reservation, using
+   new_limit for sequence 'which' (-1: none).
+   Caller holds id_alloc->reserve (or is the parent at startup). */
+static int id_tracker_save(int which, int new_limit) {
+    char buf[512];
+    int len = 0;
+    for (int i = 0; i < ID_SEQ_COUNT; i++) {
+        int limit = (i == which) ? new_limit : id_alloc->seq[i].limit;
+        len += snprintf(buf + len, sizeof(buf) - len, "%s %d\n", id_seqs[i].key, limit - 1);
+    }
+
+    int fd = open(ID_TRACKER_TMP, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return -1;
+    if (write(fd, buf, len) != len || fsync(fd) == -1) {
+        close(fd);
+        unlink(ID_TRACKER_TMP);
+        return -1;
+    }
+    close(fd);
+    return rename(ID_TRACKER_TMP, ID_TRACKER_FILE);
+}
+
+static int id_seq_index(const char *file) {
+    for (int i = 0; i < ID_SEQ_COUNT; i++)
+        if (strcmp(id_seqs[i].file, file) == 0)
+            return i;
+    return -1;
+}
+
+/* ------------------------------------------------------------
+   Map the counters and resume them from id_tracker.txt.
+   Must run in the parent before the first fork().
+   ------------------------------------------------------------ */
+int id_alloc_init(void) {
+    id_alloc = mmap(NULL, sizeof(IdAllocShared), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (id_alloc == MAP_FAILED) {
+        perror("mmap id allocator");
+        return -1;
+    }
+    if (sem_init(&id_alloc->reserve, 1, 1) == -1) {
+        perror("sem_init id allocator");
+        return -1;
+    }
+
+    int found[ID_SEQ_COUNT] = { 0 };
+    int fd = open(ID_TRACKER_FILE, O_RDONLY);
+    if (fd != -1) {
+        LineReader lr;
+        RecField f[2];
+        char *line;
+        size_t len;
+        int value;
+        line_reader_init(&lr, fd, 0, -1);
+        while ((line = line_reader_next(&lr, &len)) != NULL) {
+            if (rec_split(line, len, f, 2) != 2 || rec_int(f[1], &value) == -1) continue;
+            for (int i = 0; i < ID_SEQ_COUNT; i++) {
+                if (rec_eq(f[0], id_seqs[i].key)) {
+                    id_alloc->seq[i].next = id_alloc->seq[i].limit = value + 1;
+                    found[i] = 1;
+                }
+            }
+        }
+        close(fd);
+    }
+
+    // First run for a sequence: one scan of its file, as get_next_id() did
+    for (int i = 0; i < ID_SEQ_COUNT; i++) {
+        if (found[i]) continue;
+        int next = get_next_id(id_seqs[i].file);
+
+        if (strcmp(id_seqs[i].key, "feedback") == 0) {
+            int cfd = open(ID_LEGACY_GLOBAL_COUNTER, O_RDONLY);
+            char buf[32];
+            ssize_t n;
+            if (cfd != -1) {
+                if ((n = read(cfd, buf, sizeof(buf) - 1)) > 0) {
+                    buf[n] = '\0';
+                    if (atoi(buf) + 1 > next) next = atoi(buf) + 1;
+                }
+                close(cfd);
+            }
+        }
+        id_alloc->seq[i].next = id_alloc->seq[i].limit = next;
+    }
+    return id_tracker_save(-1, 0);
+}
+
+/* ------------------------------------------------------------
+   Next ID for records of 'file' (same meaning as get_next_id(),
+   which remains the fallback for files without a sequence).
+   Returns -1 if the reservation could not be persisted.
+   ------------------------------------------------------------ */
+int id_next(const char *file) {
+    int i = id_seq_index(file);
+    if (i < 0) return get_next_id(file);
+
+    IdSeq *s = &id_alloc->seq[i];
+    int id = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED);
+    if (id < __atomic_load_n(&s->limit, __ATOMIC_ACQUIRE))
+        return id;
+
+    // Past the reserved block: persist a bigger reservation first,
+    // then publish it so other sessions take the fast path again
+    sem_wait(&id_alloc->reserve);
+    int rc = 0;
+    while (rc == 0 && id >= s->limit) {
+        int limit = s->limit + ID_BLOCK;
+        if (id >= limit) limit = id + ID_BLOCK;
+        rc = id_tracker_save(i, limit);
+        if (rc == 0) __atomic_store_n(&s->limit, limit, __ATOMIC_RELEASE);
+    }
+    sem_post(&id_alloc->reserve);
+    return rc == 0 ? id : -1;
+}
@@ -0,0 +1,1363 @@
+/* ledger.c
+   Transaction ledger: time-partitioned binary segments plus a
+   per-user index.
+
+   The ledger is a run of segment files txlog/NNNNNN.seg, one per
+   calendar month. A segment is a LedgerSegHeader (record count,
+   min/max tx_id and timestamp) followed by fixed-size LedgerRecords
+   built on the Transaction struct (Struct.h). Rows are only ever
+   appended to the newest (active) segment; the first row of a later
+   month seals it and starts the next one. A row's location is
+   loc = (segment << 32) | record number, so locations grow in
+   append order.
+
+   Segment headers are mirrored in the shared index file, so scans
+   bounded by date (ledger_scan_range) or tx_id (recovery) skip whole
+   segments without reading them.
+
+   Cold archive: once LEDGER_HOT_SEGS newer segments exist, a sealed
+   segment is rewritten packed: blocks of LEDGER_BLOCK records, each
+   encoded with zigzag varints (tx_id and timestamp as deltas, amounts
+   in cents, usernames as back-references within the block), behind a
+   table of block offsets. Record numbers do not change, so locs and
+   the index stay valid; reads decode the one block they need and
+   everything above ledger_read_recs() is unaware of the difference.
+   The packed file replaces the raw one by rename(); a session that
+   still has the raw file open keeps reading it. Packing rewrites a
+   whole month, so while serving it is left to a packer process
+   forked at startup (ledger_packer_start); the session that rolls
+   the month over only wakes it.
+
+   Per-user index: every row also gets a link record in
+   txlog/index.links: { loc, prev, tx_id, day }, where prev is the
+   previous link of the same user. txlog/index.heads is a file-backed
+   hash (username -> newest link, row count), mapped MAP_SHARED.
+   A passbook walks one user's chain, so it costs O(rows returned)
+   no matter how big the ledger is, and paged views (ledger_page)
+   filter on tx_id and date without reading the skipped rows.
+
+   The index is derived data. heads->indexed_end records how far into
+   the ledger it reaches; at startup ledger_open() indexes whatever
+   lies beyond it and rebuilds from scratch if the files don't match.
+   Indexing a row is idempotent: a user's rows are appended in loc
+   order, so a row at or before that user's newest indexed loc is
+   already in the chain.
+
+   A legacy transactions_db.txt is converted once, when txlog/ does
+   not exist yet. The conversion is built in txlog.tmp/ and renamed
+   into place, so a crash never leaves a half-converted ledger.
+   Designed to be included directly into server.c (no header).
+*/
+
+#include "utils.h"
+#include "Struct.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <semaphore.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <signal.h>
+
+#define LEDGER_DIR         "txlog"
+#define LEDGER_TMP_DIR     "txlog.tmp"
+#define LEDGER_TEXT_FILE   "transactions_db.txt"   // legacy text format
+#define LEDGER_HEADS_NAME  "index.heads"
+#define LEDGER_LINKS_NAME  "index.links"
+#define LEDGER_SEG_MAGIC   0x47535854u       // "TXSG"
+#define LEDGER_HEADS_MAGIC 0x33485854u       // "TXH3"
+#define LEDGER_MAX_SEGS    4096              // ~340 years of monthly segments
+#define LEDGER_BUCKETS     (1 << 20)         // power of two
+#define LEDGER_CHUNK       256               // records per pread() when scanning
+#define LEDGER_HOT_SEGS    2                 // newest segments kept uncompressed
+#define LEDGER_BLOCK       64                // records per packed block
+#define LEDGER_BLOCK_MAX   (LEDGER_BLOCK * 256)   // worst-case encoded block
+
+// LedgerSegHeader.state
+#define LEDGER_SEG_ACTIVE  0                 // still being appended to
+#define LEDGER_SEG_SEALED  1                 // complete, raw records
+#define LEDGER_SEG_PACKED  2                 // complete, compressed blocks
+#define LEDGER_SEG_PACKING 3                 // shared copy only: being compressed
+
+// Transaction.tx_type values
+#define LEDGER_DEPOSIT      1
+#define LEDGER_WITHDRAW     2
+#define LEDGER_TRANSFER_OUT 3
+#define LEDGER_TRANSFER_IN  4
+
+#define LEDGER_LOC(seg, rec)  (((uint64_t)(seg) << 32) | (uint32_t)(rec))
+#define LEDGER_LOC_SEG(loc)   ((uint32_t)((loc) >> 32))
+#define LEDGER_LOC_REC(loc)   ((uint32_t)(loc))
+#define LEDGER_REC_OFFSET(rec) \
+    ((off_t)sizeof(LedgerSegHeader) + (off_t)(rec) * (off_t)sizeof(LedgerRecord))
+
+/* One ledger row */
+typedef struct {
+    Transaction tx;                  // remark: counterparty of a transfer
+    char     username[MAX_USERNAME];
+    int64_t  timestamp;
+    double   balance;                // after the transaction
+} LedgerRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seg_no;
+    int32_t  month;                  // YYYYMM the segment holds
+    int32_t  count;                  // records in the segment
+    int32_t  min_tx, max_tx;
+    int64_t  min_ts, max_ts;
+    uint32_t record_size;            // sizeof(LedgerRecord) when written
+    int32_t  state;                  // LEDGER_SEG_*
+} LedgerSegHeader;
+/* A packed segment continues with uint64_t block_off[nblocks + 1]
+   (file offsets; the last one is the end of the data) and the blocks */
+
+typedef struct {
+    uint64_t loc;                    // where the row is
+    int64_t  prev;                   // previous link of the same user, -1 = none
+    int32_t  tx_id;
+    int32_t  day;                    // YYYYMMDD of the row's timestamp
+} LedgerLink;
+
+/* Position in one user's history for paged reads, newest first.
+   Everything needed to resume is in here, so it can be handed to
+   the client and sent back later. */
+typedef struct {
+    int64_t next;                    // next link to read, -1 = no more rows
+    int before_tx;                   // only rows with tx_id < before_tx (0 = any)
+    int from_day, to_day;            // YYYYMMDD bounds (0 = open)
+} LedgerCursor;
+
+typedef struct {
+    char     username[MAX_USERNAME]; // "" = empty bucket
+    int64_t  head;                   // newest link
+    uint64_t head_loc;               // loc of that link, for idempotent indexing
+    int32_t  count;                  // rows in the chain
+    int32_t  pad;
+} LedgerHead;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t nbuckets;
+    uint32_t nsegs;                  // segments on disk; the last one is active
+    uint32_t packs;                  // bumped each time a segment is packed
+    uint64_t indexed_end;            // loc just past the last indexed row
+    int64_t  nlinks;                 // records in index.links
+    LedgerSegHeader seg[LEDGER_MAX_SEGS];   // copy of every segment's header
+    LedgerHead bucket[];
+} LedgerHeads;
+
+typedef int (*ledger_visit_fn)(const LedgerRecord *rec, void *ctx);
+
+extern sem_t *sem_ledger;
+extern sem_t *sem_ledger_pack;           // posted when segments may need packing
+
+static const char *ledger_dir = LEDGER_DIR;
+static LedgerHeads *ledger_heads = NULL;  // file-backed, inherited by children
+static size_t ledger_heads_bytes = 0;
+static int ledger_links_fd = -1;
+
+/* This thread's view of one segment file. The caches below are
+   per thread: sessions of a reactor server share the process. */
+typedef struct {
+    int fd;                          // fd + 1, 0 = not opened in this thread
+    int packed;                      // what was opened, not what the shared copy says now
+    uint32_t count;                  // packed: records
+    uint64_t *block_off;             // packed: block offset table
+} LedgerSegFile;
+
+static __thread LedgerSegFile ledger_segs[LEDGER_MAX_SEGS];
+
+static __thread uint32_t ledger_packs_seen;  // ledger_heads->packs at the last sweep
+
+// Last packed block decoded by this thread
+static __thread LedgerRecord ledger_block[LEDGER_BLOCK];
+static __thread uint32_t ledger_block_seg = UINT32_MAX, ledger_block_no = UINT32_MAX;
+
+static void ledger_path(char *out, size_t cap, const char *name) {
+    snprintf(out, cap, "%s/%s", ledger_dir, name);
+}
+
+static void ledger_seg_path(char *out, size_t cap, uint32_t seg) {
+    snprintf(out, cap, "%s/%06u.seg", ledger_dir, seg);
+}
+
+static void ledger_seg_forget(uint32_t seg) {
+    LedgerSegFile *f = &ledger_segs[seg];
+    if (f->fd) close(f->fd - 1);
+    free(f->block_off);
+    memset(f, 0, sizeof(*f));
+    if (ledger_block_seg == seg) ledger_block_seg = UINT32_MAX;
+}
+
+/* Segment file, opened on first use (segments started by another
+   session show up here too). NULL if it cannot be opened.
+   Once any segment has been packed, by whichever process, this
+   thread drops every raw file it holds that is now packed, so the
+   replaced inodes are freed instead of kept open until restart. */
+static LedgerSegFile *ledger_seg_file(uint32_t seg) {
+    if (seg >= LEDGER_MAX_SEGS) return NULL;
+    uint32_t packs = __atomic_load_n(&ledger_heads->packs, __ATOMIC_ACQUIRE);
+    if (packs != ledger_packs_seen) {
+        ledger_packs_seen = packs;
+        for (uint32_t s = 0; s < ledger_heads->nsegs; s++)
+            if (ledger_segs[s].fd && !ledger_segs[s].packed &&
+                ledger_heads->seg[s].state == LEDGER_SEG_PACKED)
+                ledger_seg_forget(s);
+    }
+
+    LedgerSegFile *f = &ledger_segs[seg];
+    if (f->fd) return f;
+
+    char path[128];
+    ledger_seg_path(path, sizeof(path), seg);
+    int fd = open(path, O_RDWR);
+    if (fd == -1) return NULL;
+
+    LedgerSegHeader h;
+    if (pread(fd, &h, sizeof(h), 0) == sizeof(h) && h.magic == LEDGER_SEG_MAGIC &&
+        h.state == LEDGER_SEG_PACKED) {
+        uint32_t nblocks = (h.count + LEDGER_BLOCK - 1) / LEDGER_BLOCK;
+        size_t bytes = (size_t)(nblocks + 1) * sizeof(uint64_t);
+        f->block_off = malloc(bytes);
+        if (!f->block_off || pread(fd, f->block_off, bytes, sizeof(h)) != (ssize_t)bytes) {
+            free(f->block_off);
+            f->block_off = NULL;
+            close(fd);
+            return NULL;
+        }
+        f->packed = 1;
+        f->count = h.count;
+    }
+    f->fd = fd + 1;
+    return f;
+}
+
+/* fd of a segment, for code that only deals with raw segments */
+static int ledger_seg_fd(uint32_t seg) {
+    LedgerSegFile *f = ledger_seg_file(seg);
+    return f ? f->fd - 1 : -1;
+}
+
+/* ------------------------------------------------------------
+   Packed block codec. Per record:
+     flags   type (bits 0-3), amount in cents (4), balance in cents (5),
+             same user as the previous record (6), has remark (7)
+     tx_id, timestamp   zigzag varint delta from the previous record
+     amount, balance    zigzag varint cents, or 8 raw bytes
+     username           varint: 0 = new (length byte + bytes),
+                        k = k-th distinct name of this block
+     account_no, user_id, and the remark (length byte + bytes)
+   ------------------------------------------------------------ */
+#define LEDGER_ZIGZAG(v)   (((uint64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define LEDGER_UNZIGZAG(u) ((int64_t)((u) >> 1) ^ -(int64_t)((u) & 1))
+
+static unsigned char *ledger_put_varint(unsigned char *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+/* NULL if the varint runs past end */
+static const unsigned char *ledger_get_varint(const unsigned char *p, const unsigned char *end,
+                                              uint64_t *v) {
+    uint64_t x = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char c = *p++;
+        x |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *v = x;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* Amount as whole cents, if that is exact */
+static int ledger_cents(double v, int64_t *cents) {
+    if (!(v > -9e13 && v < 9e13)) return 0;
+    int64_t c = (int64_t)(v * 100.0 + (v >= 0 ? 0.5 : -0.5));
+    if ((double)c / 100.0 != v) return 0;
+    *cents = c;
+    return 1;
+}
+
+static unsigned char *ledger_put_money(unsigned char *p, double v, int64_t cents, int exact) {
+    if (exact) return ledger_put_varint(p, LEDGER_ZIGZAG(cents));
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static const unsigned char *ledger_get_money(const unsigned char *p, const unsigned char *end,
+                                             int exact, double *v) {
+    if (exact) {
+        uint64_t u;
+        if (!(p = ledger_get_varint(p, end, &u))) return NULL;
+        *v = (double)LEDGER_UNZIGZAG(u) / 100.0;
+        return p;
+    }
+    if ((size_t)(end - p) < sizeof(*v)) return NULL;
+    memcpy(v, p, sizeof(*v));
+    return p + sizeof(*v);
+}
+
+/* Encode n (<= LEDGER_BLOCK) records; returns bytes written to out
+   (at least LEDGER_BLOCK_MAX bytes) */
+static size_t ledger_encode_block(const LedgerRecord *recs, int n, unsigned char *out) {
+    unsigned char *p = out;
+    const char *names[LEDGER_BLOCK];
+    int nnames = 0;
+    int32_t prev_tx = 0;
+    int64_t prev_ts = 0;
+
+    for (int i = 0; i < n; i++) {
+        const LedgerRecord *r = &recs[i];
+        int64_t amount_c = 0, balance_c = 0;
+        int amount_exact = ledger_cents(r->tx.amount, &amount_c);
+        int balance_exact = ledger_cents(r->balance, &balance_c);
+        int same_user = i > 0 && strncmp(r->username, recs[i - 1].username, MAX_USERNAME) == 0;
+        size_t remark_len = strnlen(r->tx.remark, MAX_REMARK - 1);
+
+        *p++ = (unsigned char)((r->tx.tx_type & 0x0f) | (amount_exact << 4) | (balance_exact << 5) |
+                               (same_user << 6) | ((remark_len > 0) << 7));
+        p = ledger_put_varint(p, LEDGER_ZIGZAG((int64_t)r->tx.tx_id - prev_tx));
+        p = ledger_put_varint(p, LEDGER_ZIGZAG(r->timestamp - prev_ts));
+        p = ledger_put_money(p, r->tx.amount, amount_c, amount_exact);
+        p = ledger_put_money(p, r->balance, balance_c, balance_exact);
+
+        if (!same_user) {
+            int k = 0;
+            while (k < nnames && strncmp(names[k], r->username, MAX_USERNAME) != 0) k++;
+            if (k < nnames) {
+                p = ledger_put_varint(p, k + 1);
+            } else {
+                size_t len = strnlen(r->username, MAX_USERNAME - 1);
+                p = ledger_put_varint(p, 0);
+                *p++ = (unsigned char)len;
+                memcpy(p, r->username, len);
+                p += len;
+                names[nnames++] = r->username;
+            }
+        }
+        p = ledger_put_varint(p, LEDGER_ZIGZAG(r->tx.account_no));
+        p = ledger_put_varint(p, LEDGER_ZIGZAG(r->tx.user_id));
+        if (remark_len > 0) {
+            *p++ = (unsigned char)remark_len;
+            memcpy(p, r->tx.remark, remark_len);
+            p += remark_len;
+        }
+        prev_tx = r->tx.tx_id;
+        prev_ts = r->timestamp;
+    }
+    return p - out;
+}
+
+/* Decode n records; -1 if the block is malformed */
+static int ledger_decode_block(const unsigned char *p, size_t len, int n, LedgerRecord *out) {
+    const unsigned char *end = p + len;
+    int names[LEDGER_BLOCK];             // record holding each distinct name
+    int nnames = 0;
+    int32_t prev_tx = 0;
+    int64_t prev_ts = 0;
+    uint64_t u;
+
+    for (int i = 0; i < n; i++) {
+        LedgerRecord *r = &out[i];
+        memset(r, 0, sizeof(*r));
+        if (p >= end) return -1;
+        unsigned char flags = *p++;
+        r->tx.tx_type = flags & 0x0f;
+
+        if (!(p = ledger_get_varint(p, end, &u))) return -1;
+        r->tx.tx_id = prev_tx + (int32_t)LEDGER_UNZIGZAG(u);
+        if (!(p = ledger_get_varint(p, end, &u))) return -1;
+        r->timestamp = prev_ts + LEDGER_UNZIGZAG(u);
+        if (!(p = ledger_get_money(p, end, flags & 0x10, &r->tx.amount))) return -1;
+        if (!(p = ledger_get_money(p, end, flags & 0x20, &r->balance))) return -1;
+
+        if (flags & 0x40) {
+            if (i == 0) return -1;
+            memcpy(r->username, out[i - 1].username, MAX_USERNAME);
+        } else {
+            if (!(p = ledger_get_varint(p, end, &u))) return -1;
+            if (u == 0) {
+                if (p >= end || *p >= MAX_USERNAME || end - p - 1 < *p) return -1;
+                memcpy(r->username, p + 1, *p);
+                p += 1 + *p;
+                if (nnames == LEDGER_BLOCK) return -1;
+                names[nnames++] = i;
+            } else {
+                if (u > (uint64_t)nnames) return -1;
+                memcpy(r->username, out[names[u - 1]].username, MAX_USERNAME);
+            }
+        }
+
+        if (!(p = ledger_get_varint(p, end, &u))) return -1;
+        r->tx.account_no = (int)LEDGER_UNZIGZAG(u);
+        if (!(p = ledger_get_varint(p, end, &u))) return -1;
+        r->tx.user_id = (int)LEDGER_UNZIGZAG(u);
+        if (flags & 0x80) {
+            if (p >= end || *p >= MAX_REMARK || end - p - 1 < *p) return -1;
+            memcpy(r->tx.remark, p + 1, *p);
+            p += 1 + *p;
+        }
+        prev_tx = r->tx.tx_id;
+        prev_ts = r->timestamp;
+    }
+    return 0;
+}
+
+/* Make block b of a packed segment the cached one */
+static int ledger_load_block(uint32_t seg, LedgerSegFile *f, uint32_t b) {
+    if (ledger_block_seg == seg && ledger_block_no == b) return 0;
+
+    static __thread unsigned char buf[LEDGER_BLOCK_MAX];
+    uint64_t start = f->block_off[b], len = f->block_off[b + 1] - start;
+    int n = f->count - b * LEDGER_BLOCK < LEDGER_BLOCK ? f->count - b * LEDGER_BLOCK : LEDGER_BLOCK;
+    if (len > sizeof(buf) || pread(f->fd - 1, buf, len, start) != (ssize_t)len ||
+        ledger_decode_block(buf, len, n, ledger_block) == -1) {
+        ledger_block_seg = UINT32_MAX;
+        return -1;
+    }
+    ledger_block_seg = seg;
+    ledger_block_no = b;
+    return 0;
+}
+
+/* Read records [r, r + n) of a segment, raw or packed */
+static int ledger_read_recs(uint32_t seg, uint32_t r, uint32_t n, LedgerRecord *out) {
+    LedgerSegFile *f = ledger_seg_file(seg);
+    if (!f) return -1;
+
+    if (!f->packed) {
+        ssize_t want = (ssize_t)n * sizeof(LedgerRecord);
+        return pread(f->fd - 1, out, want, LEDGER_REC_OFFSET(r)) == want ? 0 : -1;
+    }
+
+    if (r + n > f->count) return -1;
+    while (n > 0) {
+        uint32_t b = r / LEDGER_BLOCK, i = r % LEDGER_BLOCK;
+        if (ledger_load_block(seg, f, b) == -1) return -1;
+        uint32_t take = LEDGER_BLOCK - i < n ? LEDGER_BLOCK - i : n;
+        memcpy(out, &ledger_block[i], take * sizeof(LedgerRecord));
+        out += take;
+        r += take;
+        n -= take;
+    }
+    return 0;
+}
+
+/* YYYYMMDD of a timestamp, local time like the rest of the server */
+static int ledger_day(int64_t ts) {
+    time_t t = (time_t)ts;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    return (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+}
+
+static int ledger_month(int64_t ts) {
+    return ledger_day(ts) / 100;
+}
+
+const char *ledger_type_name(int type) {
+    switch (type) {
+    case LEDGER_DEPOSIT:      return "deposit";
+    case LEDGER_WITHDRAW:     return "withdraw";
+    case LEDGER_TRANSFER_OUT: return "transfer-out";
+    case LEDGER_TRANSFER_IN:  return "transfer-in";
+    default:                  return "unknown";
+    }
+}
+
+/* Timestamp in the format the text ledger used: YYYY-MM-DD_HH:MM:SS */
+void ledger_format_time(int64_t ts, char *out, size_t cap) {
+    time_t t = (time_t)ts;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    snprintf(out, cap, "%04d-%02d-%02d_%02d:%02d:%02d",
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+static uint32_t ledger_hash(const char *username) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)username; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Bucket for username; with create, claims an empty one. NULL if absent/full. */
+static LedgerHead *ledger_head(const char *username, int create) {
+    uint32_t mask = ledger_heads->nbuckets - 1;
+    uint32_t b = ledger_hash(username) & mask;
+
+    for (uint32_t probes = 0; probes < ledger_heads->nbuckets; probes++, b = (b + 1) & mask) {
+        LedgerHead *h = &ledger_heads->bucket[b];
+        if (h->username[0] == '\0') {
+            if (!create) return NULL;
+            strncpy(h->username, username, MAX_USERNAME - 1);
+            h->head = -1;
+            h->head_loc = 0;
+            h->count = 0;
+            return h;
+        }
+        if (strcmp(h->username, username) == 0) return h;
+    }
+    return NULL;
+}
+
+/* Link the row at 'loc' into its user's chain. Caller holds sem_ledger
+   (or is the parent at startup). */
+static int ledger_index_rec(const LedgerRecord *rec, uint64_t loc) {
+    if (rec->username[0] == '\0' || memchr(rec->username, '\0', MAX_USERNAME) == NULL)
+        return 0;
+
+    LedgerHead *h = ledger_head(rec->username, 1);
+    if (!h) return -1;
+    if (h->head >= 0 && h->head_loc >= loc) return 0;   // already indexed
+
+    LedgerLink link = { loc, h->head, rec->tx.tx_id, ledger_day(rec->timestamp) };
+    off_t at = (off_t)ledger_heads->nlinks * sizeof(LedgerLink);
+    if (pwrite(ledger_links_fd, &link, sizeof(link), at) != sizeof(link)) return -1;
+
+    h->head = ledger_heads->nlinks++;
+    h->head_loc = loc;
+    h->count++;
+    return 0;
+}
+
+/* 1 if the index covers every row in the ledger */
+static int ledger_index_current(void) {
+    uint32_t s = LEDGER_LOC_SEG(ledger_heads->indexed_end);
+    uint32_t r = LEDGER_LOC_REC(ledger_heads->indexed_end);
+    while (s + 1 < ledger_heads->nsegs && r == (uint32_t)ledger_heads->seg[s].count) {
+        s++;
+        r = 0;
+    }
+    return s == ledger_heads->nsegs - 1 && r == (uint32_t)ledger_heads->seg[s].count;
+}
+
+/* Index every row past indexed_end */
+static int ledger_index_catch_up(void) {
+    static __thread LedgerRecord chunk[LEDGER_CHUNK];
+    uint32_t first = LEDGER_LOC_SEG(ledger_heads->indexed_end);
+
+    for (uint32_t s = first; s < ledger_heads->nsegs; s++) {
+        uint32_t r = (s == first) ? LEDGER_LOC_REC(ledger_heads->indexed_end) : 0;
+        uint32_t count = ledger_heads->seg[s].count;
+
+        while (r < count) {
+            uint32_t n = count - r < LEDGER_CHUNK ? count - r : LEDGER_CHUNK;
+            if (ledger_read_recs(s, r, n, chunk) == -1) return -1;
+            for (uint32_t i = 0; i < n; i++) {
+                if (ledger_index_rec(&chunk[i], LEDGER_LOC(s, r + i)) == -1) return -1;
+                ledger_heads->indexed_end = LEDGER_LOC(s, r + i + 1);
+            }
+            r += n;
+        }
+    }
+    return 0;
+}
+
+/* Start segment 'seg' for 'month'. Caller holds sem_ledger (or is the
+   parent at startup). */
+static int ledger_seg_create(uint32_t seg, int month) {
+    if (seg >= LEDGER_MAX_SEGS) return -1;
+
+    LedgerSegHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = LEDGER_SEG_MAGIC;
+    h.seg_no = seg;
+    h.month = month;
+    h.record_size = sizeof(LedgerRecord);
+
+    char path[128];
+    ledger_seg_path(path, sizeof(path), seg);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return -1;
+    if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) {
+        close(fd);
+        return -1;
+    }
+    ledger_seg_forget(seg);
+    ledger_segs[seg].fd = fd + 1;
+
+    ledger_heads->seg[seg] = h;
+    ledger_heads->nsegs = seg + 1;
+    return 0;
+}
+
+/* The active segment is complete: flush it and mark it sealed */
+static int ledger_seg_seal(uint32_t seg) {
+    LedgerSegHeader *h = &ledger_heads->seg[seg];
+    int fd = ledger_seg_fd(seg);
+    if (fd == -1) return -1;
+
+    h->state = LEDGER_SEG_SEALED;
+    if (pwrite(fd, h, sizeof(*h), 0) != sizeof(*h)) return -1;
+    return fdatasync(fd);
+}
+
+/* ------------------------------------------------------------
+   Rewrite sealed segment 'seg' packed and rename it over the raw
+   file. Runs without sem_ledger: a sealed segment never changes.
+   *saved gets the bytes saved.
+   ------------------------------------------------------------ */
+static int ledger_seg_pack(uint32_t seg, off_t *saved) {
+    static __thread LedgerRecord recs[LEDGER_BLOCK];
+    static __thread unsigned char buf[LEDGER_BLOCK_MAX];
+    char path[128], tmp[160];
+    ledger_seg_path(path, sizeof(path), seg);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    LedgerSegHeader h;
+    struct stat st;
+    int in = open(path, O_RDONLY);
+    if (in == -1) return -1;
+    if (fstat(in, &st) == -1 || pread(in, &h, sizeof(h), 0) != sizeof(h) ||
+        h.state != LEDGER_SEG_SEALED) {
+        close(in);
+        return -1;
+    }
+
+    uint32_t nblocks = (h.count + LEDGER_BLOCK - 1) / LEDGER_BLOCK;
+    uint64_t *block_off = malloc((size_t)(nblocks + 1) * sizeof(uint64_t));
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (!block_off || out == -1) goto fail;
+
+    uint64_t pos = sizeof(h) + (uint64_t)(nblocks + 1) * sizeof(uint64_t);
+    for (uint32_t b = 0; b < nblocks; b++) {
+        uint32_t first = b * LEDGER_BLOCK;
+        int n = h.count - first < LEDGER_BLOCK ? h.count - first : LEDGER_BLOCK;
+        ssize_t want = (ssize_t)n * sizeof(LedgerRecord);
+        if (pread(in, recs, want, LEDGER_REC_OFFSET(first)) != want) goto fail;
+
+        size_t len = ledger_encode_block(recs, n, buf);
+        if (pwrite(out, buf, len, pos) != (ssize_t)len) goto fail;
+        block_off[b] = pos;
+        pos += len;
+    }
+    block_off[nblocks] = pos;
+
+    h.state = LEDGER_SEG_PACKED;
+    size_t table = (size_t)(nblocks + 1) * sizeof(uint64_t);
+    if (pwrite(out, &h, sizeof(h), 0) != sizeof(h) ||
+        pwrite(out, block_off, table, sizeof(h)) != (ssize_t)table || fsync(out) == -1)
+        goto fail;
+    close(out);
+    close(in);
+    free(block_off);
+
+    if (rename(tmp, path) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+    int dfd = open(ledger_dir, O_RDONLY);
+    if (dfd != -1) {
+        fsync(dfd);
+        close(dfd);
+    }
+
+    ledger_seg_forget(seg);             // reopen as packed on next use
+    *saved = st.st_size - (off_t)pos;
+    return 0;
+
+fail:
+    if (out != -1) {
+        close(out);
+        unlink(tmp);
+    }
+    close(in);
+    free(block_off);
+    return -1;
+}
+
+/* ------------------------------------------------------------
+   Pack every sealed segment that has LEDGER_HOT_SEGS newer ones.
+   Each segment is claimed under sem_ledger, so two sessions never
+   pack the same one. Returns segments packed.
+   ------------------------------------------------------------ */
+static int ledger_pack_cold(off_t *saved) {
+    int packed = 0;
+    *saved = 0;
+    for (;;) {
+        uint32_t seg = UINT32_MAX;
+        sem_wait(sem_ledger);
+        for (uint32_t s = 0; s + LEDGER_HOT_SEGS < ledger_heads->nsegs; s++) {
+            if (ledger_heads->seg[s].state == LEDGER_SEG_SEALED) {
+                ledger_heads->seg[s].state = LEDGER_SEG_PACKING;
+                seg = s;
+                break;
+            }
+        }
+        sem_post(sem_ledger);
+        if (seg == UINT32_MAX) break;
+
+        off_t gain = 0;
+        int rc = ledger_seg_pack(seg, &gain);
+        sem_wait(sem_ledger);
+        ledger_heads->seg[seg].state = (rc == 0) ? LEDGER_SEG_PACKED : LEDGER_SEG_SEALED;
+        if (rc == 0) __atomic_add_fetch(&ledger_heads->packs, 1, __ATOMIC_RELEASE);
+        sem_post(sem_ledger);
+        if (rc == -1) {
+            fprintf(stderr, "%s: could not pack segment %u\n", ledger_dir, seg);
+            break;
+        }
+        packed++;
+        *saved += gain;
+    }
+    return packed;
+}
+
+/* ------------------------------------------------------------
+   Append rows to the active segment, starting a new segment when
+   a row belongs to a later month, and index them. An index left
+   behind by an earlier failure is caught up first, so one failed
+   link does not stop indexing until the next restart. Caller holds
+   sem_ledger (or is the parent at startup).
+   ------------------------------------------------------------ */
+static int ledger_write(const LedgerRecord *recs, int n) {
+    int index = ledger_index_current() || ledger_index_catch_up() == 0;
+
+    for (int i = 0; i < n; ) {
+        uint32_t s = ledger_heads->nsegs - 1;
+        LedgerSegHeader *h = &ledger_heads->seg[s];
+        int month = ledger_month(recs[i].timestamp);
+        if (h->count == 0) {
+            h->month = month;   // still empty: it holds whatever comes first
+        } else if (month > h->month) {
+            if (ledger_seg_seal(s) == -1 || ledger_seg_create(s + 1, month) == -1)
+                return -1;
+            continue;
+        }
+
+        // Rows stamped before the segment's month (clock steps, restored
+        // rows) stay in it; min_ts/max_ts keep range scans correct
+        int j = i + 1;
+        while (j < n && ledger_month(recs[j].timestamp) <= h->month) j++;
+
+        int fd = ledger_seg_fd(s);
+        ssize_t bytes = (ssize_t)(j - i) * sizeof(LedgerRecord);
+        if (fd == -1 || pwrite(fd, &recs[i], bytes, LEDGER_REC_OFFSET(h->count)) != bytes)
+            return -1;
+
+        for (int k = i; k < j; k++) {
+            const LedgerRecord *r = &recs[k];
+            if (h->count == 0 || r->tx.tx_id < h->min_tx) h->min_tx = r->tx.tx_id;
+            if (h->count == 0 || r->tx.tx_id > h->max_tx) h->max_tx = r->tx.tx_id;
+            if (h->count == 0 || r->timestamp < h->min_ts) h->min_ts = r->timestamp;
+            if (h->count == 0 || r->timestamp > h->max_ts) h->max_ts = r->timestamp;
+
+            // The index only ever trails the ledger; the next write (or
+            // ledger_open() after a crash) catches up
+            if (index && ledger_index_rec(r, LEDGER_LOC(s, h->count)) == -1) index = 0;
+            h->count++;
+            if (index) ledger_heads->indexed_end = LEDGER_LOC(s, h->count);
+        }
+
+        // Rows first, then the count that makes them visible after a restart
+        if (pwrite(fd, h, sizeof(*h), 0) != sizeof(*h)) return -1;
+        i = j;
+    }
+    return 0;
+}
+
+/* Recompute a segment's bounds from its records (after a crash left
+   rows the header does not count) */
+static int ledger_seg_rescan(int fd, LedgerSegHeader *h, uint32_t count) {
+    static __thread LedgerRecord chunk[LEDGER_CHUNK];
+    h->count = 0;
+    for (uint32_t r = 0; r < count; ) {
+        uint32_t n = count - r < LEDGER_CHUNK ? count - r : LEDGER_CHUNK;
+        ssize_t want = (ssize_t)n * sizeof(LedgerRecord);
+        if (pread(fd, chunk, want, LEDGER_REC_OFFSET(r)) != want) return -1;
+        for (uint32_t i = 0; i < n; i++, h->count++) {
+            const LedgerRecord *rec = &chunk[i];
+            if (h->count == 0 || rec->tx.tx_id < h->min_tx) h->min_tx = rec->tx.tx_id;
+            if (h->count == 0 || rec->tx.tx_id > h->max_tx) h->max_tx = rec->tx.tx_id;
+            if (h->count == 0 || rec->timestamp < h->min_ts) h->min_ts = rec->timestamp;
+            if (h->count == 0 || rec->timestamp > h->max_ts) h->max_ts = rec->timestamp;
+        }
+        r += n;
+    }
+    return 0;
+}
+
+/* Read every segment header into the shared copy. For raw segments,
+   cut off a torn last record and count rows written after the header
+   was. */
+static int ledger_load_segments(void) {
+    uint32_t s;
+    for (s = 0; s < LEDGER_MAX_SEGS; s++) {
+        char path[128], tmp[160];
+        ledger_seg_path(path, sizeof(path), s);
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        unlink(tmp);                     // packing interrupted by a crash
+        if (access(path, F_OK) != 0) break;
+
+        LedgerSegHeader h;
+        struct stat st;
+        int fd = ledger_seg_fd(s);
+        if (fd == -1 || fstat(fd, &st) == -1) return -1;
+        if (st.st_size < (off_t)sizeof(h)) {
+            // Crashed while starting this segment: nothing was written to it yet
+            ledger_seg_forget(s);
+            unlink(path);
+            break;
+        }
+        if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != LEDGER_SEG_MAGIC ||
+            h.seg_no != s || h.record_size != sizeof(LedgerRecord)) {
+            fprintf(stderr, "%s: segment %u is damaged\n", ledger_dir, s);
+            return -1;
+        }
+        if (h.state == LEDGER_SEG_PACKED) {
+            ledger_heads->seg[s] = h;    // written whole and renamed into place
+            continue;
+        }
+
+        uint32_t on_disk = (st.st_size - (off_t)sizeof(h)) / (off_t)sizeof(LedgerRecord);
+        if (st.st_size != LEDGER_REC_OFFSET(on_disk) && ftruncate(fd, LEDGER_REC_OFFSET(on_disk)) == -1)
+            return -1;
+        if ((uint32_t)h.count != on_disk) {
+            if (ledger_seg_rescan(fd, &h, on_disk) == -1 || pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+                return -1;
+        }
+        ledger_heads->seg[s] = h;
+    }
+
+    ledger_heads->nsegs = s;
+    if (s == 0) return ledger_seg_create(0, ledger_month(time(NULL)));
+    return 0;
+}
+
+/* Map the index and segments of ledger_dir and bring the index up to date */
+static int ledger_attach(void) {
+    char path[128];
+    ledger_path(path, sizeof(path), LEDGER_LINKS_NAME);
+    ledger_links_fd = open(path, O_RDWR | O_CREAT, 0644);
+    ledger_path(path, sizeof(path), LEDGER_HEADS_NAME);
+    int hfd = open(path, O_RDWR | O_CREAT, 0644);
+    if (ledger_links_fd == -1 || hfd == -1) {
+        perror("open ledger index");
+        if (hfd != -1) close(hfd);
+        return -1;
+    }
+
+    size_t bytes = sizeof(LedgerHeads) + (size_t)LEDGER_BUCKETS * sizeof(LedgerHead);
+    struct stat st;
+    int fresh = (fstat(hfd, &st) == -1 || (size_t)st.st_size != bytes);
+    if (fresh && ftruncate(hfd, bytes) == -1) {
+        perror("ftruncate ledger index");
+        close(hfd);
+        return -1;
+    }
+    ledger_heads = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, hfd, 0);
+    close(hfd);
+    if (ledger_heads == MAP_FAILED) {
+        ledger_heads = NULL;
+        perror("mmap ledger index");
+        return -1;
+    }
+    ledger_heads_bytes = bytes;
+
+    if (ledger_load_segments() == -1) return -1;
+
+    struct stat kst;
+    if (fstat(ledger_links_fd, &kst) == -1) return -1;
+
+    // Anything inconsistent: start over from an empty index
+    uint32_t iseg = LEDGER_LOC_SEG(ledger_heads->indexed_end);
+    if (fresh || ledger_heads->magic != LEDGER_HEADS_MAGIC ||
+        ledger_heads->nbuckets != LEDGER_BUCKETS ||
+        iseg >= ledger_heads->nsegs ||
+        LEDGER_LOC_REC(ledger_heads->indexed_end) > (uint32_t)ledger_heads->seg[iseg].count ||
+        ledger_heads->nlinks < 0 ||
+        (off_t)(ledger_heads->nlinks * sizeof(LedgerLink)) > kst.st_size) {
+        memset(ledger_heads->bucket, 0, (size_t)LEDGER_BUCKETS * sizeof(LedgerHead));
+        ledger_heads->magic = LEDGER_HEADS_MAGIC;
+        ledger_heads->nbuckets = LEDGER_BUCKETS;
+        ledger_heads->indexed_end = 0;
+        ledger_heads->nlinks = 0;
+        if (ftruncate(ledger_links_fd, 0) == -1) return -1;
+    }
+
+    int64_t before = ledger_heads->nlinks;
+    if (ledger_index_catch_up() == -1) {
+        perror("index ledger");
+        return -1;
+    }
+    if (ledger_heads->nlinks > before)
+        printf("Indexed %lld ledger rows\n", (long long)(ledger_heads->nlinks - before));
+    return 0;
+}
+
+/* Flush and close everything ledger_attach() opened */
+static void ledger_detach(void) {
+    for (int s = 0; s < LEDGER_MAX_SEGS; s++) {
+        if (!ledger_segs[s].fd) continue;
+        fsync(ledger_segs[s].fd - 1);
+        ledger_seg_forget(s);
+    }
+    if (ledger_links_fd != -1) {
+        fsync(ledger_links_fd);
+        close(ledger_links_fd);
+        ledger_links_fd = -1;
+    }
+    if (ledger_heads) {
+        msync(ledger_heads, ledger_heads_bytes, MS_SYNC);
+        munmap(ledger_heads, ledger_heads_bytes);
+        ledger_heads = NULL;
+    }
+}
+
+/* "YYYY-MM-DD_HH:MM:SS" (any single non-digit between the numbers) */
+static int ledger_parse_stamp(RecField f, struct tm *tm) {
+    int v[6], i = 0;
+    for (int k = 0; k < 6; k++) {
+        if (i >= f.len || f.p[i] < '0' || f.p[i] > '9') return -1;
+        for (v[k] = 0; i < f.len && f.p[i] >= '0' && f.p[i] <= '9'; i++)
+            v[k] = v[k] * 10 + (f.p[i] - '0');
+        i++;                             // the separator
+    }
+    tm->tm_year = v[0] - 1900;
+    tm->tm_mon = v[1] - 1;
+    tm->tm_mday = v[2];
+    tm->tm_hour = v[3];
+    tm->tm_min = v[4];
+    tm->tm_sec = v[5];
+    tm->tm_isdst = -1;
+    return 0;
+}
+
+/* Text ledger row -> record. Format:
+   <tx_id> <username> <tx_type> <amount> <YYYY-MM-DD_HH:MM:SS> <balance> */
+static int ledger_parse_text_row(const char *line, size_t len, LedgerRecord *rec) {
+    RecField f[6];
+    struct tm tm;
+    memset(rec, 0, sizeof(*rec));
+    memset(&tm, 0, sizeof(tm));
+    if (rec_split(line, len, f, 6) != 6 || rec_int(f[0], &rec->tx.tx_id) == -1 ||
+        rec_double(f[3], &rec->tx.amount) == -1 || ledger_parse_stamp(f[4], &tm) == -1 ||
+        rec_double(f[5], &rec->balance) == -1)
+        return -1;
+    rec_copy(f[1], rec->username, sizeof(rec->username));
+    rec->timestamp = mktime(&tm);
+
+    if      (rec_eq(f[2], "deposit"))      rec->tx.tx_type = LEDGER_DEPOSIT;
+    else if (rec_eq(f[2], "withdraw"))     rec->tx.tx_type = LEDGER_WITHDRAW;
+    else if (rec_eq(f[2], "transfer-out")) rec->tx.tx_type = LEDGER_TRANSFER_OUT;
+    else if (rec_eq(f[2], "transfer-in"))  rec->tx.tx_type = LEDGER_TRANSFER_IN;
+    else return -1;
+
+    int slot = account_table_find(rec->username);
+    if (slot >= 0) {
+        rec->tx.account_no = acct_table->rec[slot].account_no;
+        rec->tx.user_id = acct_table->rec[slot].user_id;
+    }
+    return 0;
+}
+
+/* Append every row of transactions_db.txt; returns rows converted */
+static int ledger_convert_text(void) {
+    int fd = open(LEDGER_TEXT_FILE, O_RDONLY);
+    if (fd == -1) return 0;
+
+    static LineReader lr;
+    static LedgerRecord batch[LEDGER_CHUNK];
+    int nbatch = 0, count = 0;
+    char *line;
+    size_t len;
+
+    line_reader_init(&lr, fd, 0, -1);
+    while ((line = line_reader_next(&lr, &len)) != NULL) {
+        if (ledger_parse_text_row(line, len, &batch[nbatch]) == -1) continue;
+        if (++nbatch == LEDGER_CHUNK) {
+            if (ledger_write(batch, nbatch) == -1) goto fail;
+            count += nbatch;
+            nbatch = 0;
+        }
+    }
+    if (ledger_write(batch, nbatch) == -1) goto fail;
+    close(fd);
+    return count + nbatch;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+/* Remove a directory of regular files */
+static void ledger_remove_dir(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) return;
+
+    struct dirent *de;
+    char file[512];
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+        unlink(file);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+/* Build txlog/ in txlog.tmp/ (from transactions_db.txt if there is
+   one) and rename it into place. Returns rows converted or -1. */
+static int ledger_migrate(void) {
+    ledger_remove_dir(LEDGER_TMP_DIR);   // an interrupted earlier attempt
+    if (mkdir(LEDGER_TMP_DIR, 0755) == -1) return -1;
+
+    ledger_dir = LEDGER_TMP_DIR;
+    int n = ledger_attach() == 0 ? ledger_convert_text() : -1;
+    ledger_detach();
+    ledger_dir = LEDGER_DIR;
+
+    if (n < 0 || rename(LEDGER_TMP_DIR, LEDGER_DIR) == -1) {
+        ledger_remove_dir(LEDGER_TMP_DIR);
+        return -1;
+    }
+
+    int dfd = open(".", O_RDONLY);
+    if (dfd != -1) {
+        fsync(dfd);
+        close(dfd);
+    }
+    return n;
+}
+
+/* ------------------------------------------------------------
+   Open the ledger and its index, converting a legacy text ledger
+   on first start, and bring the index up to date.
+   Sealed segments outside the hot window are packed here.
+   Must run in the parent before wal_recover() and the first
+   fork(). Returns 0 or -1.
+   ------------------------------------------------------------ */
+int ledger_open(void) {
+    if (access(LEDGER_DIR, F_OK) != 0) {
+        int n = ledger_migrate();
+        if (n < 0) {
+            perror("transactions_db.txt conversion");
+            return -1;
+        }
+        if (n > 0)
+            printf("Converted %d transactions from %s to %s/\n", n, LEDGER_TEXT_FILE, LEDGER_DIR);
+    }
+    if (ledger_attach() == -1) return -1;
+
+    off_t saved;
+    int packed = ledger_pack_cold(&saved);
+    if (packed > 0)
+        printf("Packed %d old ledger segments, saved %lld bytes\n", packed, (long long)saved);
+
+    // Sessions open segments themselves, so a segment packed later is
+    // not kept alive in its raw form by fds inherited from the parent
+    for (int s = 0; s < LEDGER_MAX_SEGS; s++)
+        if (ledger_segs[s].fd) ledger_seg_forget(s);
+    return 0;
+}
+
+/* ------------------------------------------------------------
+   Append rows and link each into its user's chain, under one
+   hold of sem_ledger. *rolled is set if a new month started a
+   segment; the caller then owes a ledger_pack_request() once it
+   is off its own critical path.
+   ------------------------------------------------------------ */
+int ledger_append_rows(const LedgerRecord *recs, int n, int *rolled) {
+    sem_wait(sem_ledger);
+    uint32_t nsegs = ledger_heads->nsegs;
+    int rc = ledger_write(recs, n);
+    *rolled = ledger_heads->nsegs != nsegs;
+    sem_post(sem_ledger);
+    return rc;
+}
+
+/* Append rows and pack whatever a new month pushed out of the hot window */
+int ledger_append(const LedgerRecord *recs, int n) {
+    int rolled;
+    int rc = ledger_append_rows(recs, n, &rolled);
+    if (rolled) {
+        off_t saved;
+        ledger_pack_cold(&saved);
+    }
+    return rc;
+}
+
+/* ------------------------------------------------------------
+   Background packer: a child of the server that packs cold
+   segments whenever sem_ledger_pack is posted, so no session waits
+   for a month of rows to be rewritten. Started by the parent after
+   startup packing and recovery, before any session or listener
+   exists. It exits with the parent, and the parent starts a new
+   one if it dies (ledger_packer_reaped).
+   ------------------------------------------------------------ */
+static pid_t ledger_packer_pid = -1;
+
+int ledger_packer_start(void) {
+    while (sem_trywait(sem_ledger_pack) == 0)
+        ;                                // the first pass below covers these
+
+    pid_t parent = getpid();
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+    if (pid > 0) {
+        ledger_packer_pid = pid;
+        return 0;
+    }
+
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != parent) _exit(0);
+    for (;;) {
+        // A restarted packer first catches up on what rolled while it was gone
+        off_t saved;
+        int packed = ledger_pack_cold(&saved);
+        if (packed > 0) {
+            printf("Packed %d old ledger segments, saved %lld bytes\n", packed, (long long)saved);
+            fflush(stdout);
+        }
+
+        while (sem_wait(sem_ledger_pack) == -1 && errno == EINTR)
+            ;
+        while (sem_trywait(sem_ledger_pack) == 0)
+            ;                            // one pass serves every request so far
+    }
+}
+
+/* Called by the parent for every child it reaps. If it was the
+   packer, hand back the segment it was packing and start a new
+   one; sessions keep posting sem_ledger_pack in the meantime.
+   Returns 1 if pid was the packer. */
+int ledger_packer_reaped(pid_t pid) {
+    if (pid != ledger_packer_pid || pid <= 0) return 0;
+
+    fprintf(stderr, "ledger packer %d exited, restarting it\n", (int)pid);
+    sem_wait(sem_ledger);
+    for (uint32_t s = 0; s < ledger_heads->nsegs; s++)
+        if (ledger_heads->seg[s].state == LEDGER_SEG_PACKING)
+            ledger_heads->seg[s].state = LEDGER_SEG_SEALED;
+    sem_post(sem_ledger);
+
+    ledger_packer_pid = -1;
+    if (ledger_packer_start() == -1)
+        perror("ledger packer");         // cold segments wait for the next start
+    return 1;
+}
+
+/* Have the packer pack whatever a new month pushed out of the hot
+   window. Without a packer (startup, or fork failed) pack here. */
+void ledger_pack_request(void) {
+    if (ledger_packer_pid > 0) {
+        sem_post(sem_ledger_pack);
+        return;
+    }
+    off_t saved;
+    ledger_pack_cold(&saved);
+}
+
+/* Make appended rows durable */
+int ledger_sync(void) {
+    sem_wait(sem_ledger);
+    int fd = ledger_seg_fd(ledger_heads->nsegs - 1);
+    sem_post(sem_ledger);
+    return fd == -1 ? -1 : fdatasync(fd);
+}
+
+/* Position just past the newest row */
+uint64_t ledger_end(void) {
+    sem_wait(sem_ledger);
+    uint32_t s = ledger_heads->nsegs - 1;
+    uint64_t end = LEDGER_LOC(s, ledger_heads->seg[s].count);
+    sem_post(sem_ledger);
+    return end;
+}
+
+/* Highest tx_id in the ledger (0 if empty), from the segment headers */
+int ledger_max_tx_id(void) {
+    int max = 0;
+    sem_wait(sem_ledger);
+    for (uint32_t s = 0; s < ledger_heads->nsegs; s++)
+        if (ledger_heads->seg[s].count > 0 && ledger_heads->seg[s].max_tx > max)
+            max = ledger_heads->seg[s].max_tx;
+    sem_post(sem_ledger);
+    return max;
+}
+
+/* Read the row at loc */
+static int ledger_read(uint64_t loc, LedgerRecord *out) {
+    return ledger_read_recs(LEDGER_LOC_SEG(loc), LEDGER_LOC_REC(loc), 1, out);
+}
+
+/* ------------------------------------------------------------
+   Call fn on the rows at or after 'from' whose tx_id is in
+   [lo, hi), reading only segments whose id range overlaps it.
+   ------------------------------------------------------------ */
+int ledger_scan_ids(uint64_t from, int lo, int hi, ledger_visit_fn fn, void *ctx) {
+    static __thread LedgerRecord chunk[LEDGER_CHUNK];
+    sem_wait(sem_ledger);
+    uint32_t nsegs = ledger_heads->nsegs;
+    sem_post(sem_ledger);
+
+    for (uint32_t s = LEDGER_LOC_SEG(from); s < nsegs; s++) {
+        sem_wait(sem_ledger);
+        LedgerSegHeader h = ledger_heads->seg[s];
+        sem_post(sem_ledger);
+        if (h.count == 0 || h.max_tx < lo || h.min_tx >= hi) continue;
+
+        uint32_t r = (s == LEDGER_LOC_SEG(from)) ? LEDGER_LOC_REC(from) : 0;
+        while (r < (uint32_t)h.count) {
+            uint32_t n = h.count - r < LEDGER_CHUNK ? h.count - r : LEDGER_CHUNK;
+            if (ledger_read_recs(s, r, n, chunk) == -1) return -1;
+            for (uint32_t i = 0; i < n; i++)
+                if (chunk[i].tx.tx_id >= lo && chunk[i].tx.tx_id < hi && fn(&chunk[i], ctx) == -1)
+                    return 0;
+            r += n;
+        }
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------
+   Call fn on every row dated within [from_day, to_day] (YYYYMMDD,
+   0 = open), in ledger order. Segments entirely outside the range
+   are skipped without being read.
+   Returns the number of rows visited, or -1.
+   The rows are read into per-call storage, not a thread buffer: fn
+   may send, and a reactor session parked in a send lets another
+   session run a scan on the same thread.
+   ------------------------------------------------------------ */
+int ledger_scan_range(int from_day, int to_day, ledger_visit_fn fn, void *ctx) {
+    LedgerRecord *chunk = malloc(LEDGER_CHUNK * sizeof(LedgerRecord));
+    if (!chunk) return -1;
+    sem_wait(sem_ledger);
+    uint32_t nsegs = ledger_heads->nsegs;
+    sem_post(sem_ledger);
+
+    int visited = 0;
+    for (uint32_t s = 0; s < nsegs; s++) {
+        sem_wait(sem_ledger);
+        LedgerSegHeader h = ledger_heads->seg[s];
+        sem_post(sem_ledger);
+        if (h.count == 0) continue;
+        if ((from_day && ledger_day(h.max_ts) < from_day) || (to_day && ledger_day(h.min_ts) > to_day))
+            continue;
+
+        for (uint32_t r = 0; r < (uint32_t)h.count; ) {
+            uint32_t n = h.count - r < LEDGER_CHUNK ? h.count - r : LEDGER_CHUNK;
+            if (ledger_read_recs(s, r, n, chunk) == -1) {
+                visited = -1;
+                goto out;
+            }
+            for (uint32_t i = 0; i < n; i++) {
+                int day = ledger_day(chunk[i].timestamp);
+                if ((from_day && day < from_day) || (to_day && day > to_day)) continue;
+                visited++;
+                if (fn(&chunk[i], ctx) == -1) goto out;
+            }
+            r += n;
+        }
+    }
+out:
+    free(chunk);
+    return visited;
+}
+
+/* ------------------------------------------------------------
+   Call fn on each of username's rows, oldest first, without
+   holding sem_ledger: the chain head is read under the lock and
+   links and rows never change once written.
+   Returns the number of rows visited, or -1.
+   ------------------------------------------------------------ */
+int ledger_scan_user(const char *username, ledger_visit_fn fn, void *ctx) {
+    sem_wait(sem_ledger);
+    LedgerHead *h = ledger_head(username, 0);
+    int64_t head = h ? h->head : -1;
+    int count = h ? h->count : 0;
+    sem_post(sem_ledger);
+
+    if (count == 0) return 0;
+
+    uint64_t *locs = malloc((size_t)count * sizeof(uint64_t));
+    if (!locs) return -1;
+
+    // The chain runs newest -> oldest; fill the array from the back
+    int n = count;
+    for (int64_t at = head; at >= 0 && n > 0; ) {
+        LedgerLink link;
+        if (pread(ledger_links_fd, &link, sizeof(link), (off_t)at * sizeof(link)) != sizeof(link))
+            break;
+        locs[--n] = link.loc;
+        at = link.prev;
+    }
+
+    int visited = 0;
+    LedgerRecord rec;
+    for (int i = n; i < count; i++) {
+        if (ledger_read(locs[i], &rec) == -1) continue;
+        visited++;
+        if (fn(&rec, ctx) == -1) break;
+    }
+    free(locs);
+    return visited;
+}
+
+/* Start a cursor at username's newest row */
+void ledger_cursor_start(const char *username, LedgerCursor *c) {
+    sem_wait(sem_ledger);
+    LedgerHead *h = ledger_head(username, 0);
+    c->next = h ? h->head : -1;
+    sem_post(sem_ledger);
+}
+
+/* ------------------------------------------------------------
+   Send up to 'limit' of username's rows that match the cursor's
+   filters, newest first, and advance the cursor past them. Only
+   links are read for skipped rows; only the page's rows are read
+   from the ledger. Returns rows sent, or -1 if the cursor does not
+   point into this user's history.
+   ------------------------------------------------------------ */
+int ledger_page(const char *username, LedgerCursor *c, int limit, ledger_visit_fn fn, void *ctx) {
+    sem_wait(sem_ledger);
+    int64_t nlinks = ledger_heads->nlinks;
+    sem_post(sem_ledger);
+
+    int sent = 0, checked = 0;
+    while (c->next >= 0 && sent < limit) {
+        if (c->next >= nlinks) return -1;
+
+        LedgerLink link;
+        if (pread(ledger_links_fd, &link, sizeof(link), (off_t)c->next * sizeof(link)) != sizeof(link))
+            return -1;
+
+        // Days only decrease along the chain: past from_day there is nothing left
+        if (c->from_day && link.day < c->from_day) {
+            c->next = -1;
+            break;
+        }
+        c->next = link.prev;
+        if ((c->before_tx && link.tx_id >= c->before_tx) || (c->to_day && link.day > c->to_day))
+            continue;
+
+        LedgerRecord rec;
+        if (ledger_read(link.loc, &rec) == -1) return -1;
+
+        // A cursor from the client must not open someone else's rows
+        if (!checked) {
+            if (strncmp(rec.username, username, MAX_USERNAME) != 0) return -1;
+            checked = 1;
+        }
+        sent++;
+        if (fn(&rec, ctx) == -1) break;
+    }
+    return sent;
+}
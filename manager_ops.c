@@ -14,44 +14,51 @@
 #include <semaphore.h>
 
 // extern semaphores created in server.c
-extern sem_t *sem_userdb;   // protects user DBs
-extern sem_t *sem_account;  // protects loan/feedback/account operations
+extern sem_t *sem_userdb;   // protects user DBs and feedback_db.txt
+extern sem_t *sem_loan;     // protects loan_db.txt
 
 /* ------------------------------------------------------------
-   Helper: send whole file contents to client (line by line)
+   Helper: send whole file contents to client, streamed from the
+   page cache (send_snapshot). 'lock' is held only while the
+   snapshot is taken, so a slow client never holds up writers of
+   the file.
    ------------------------------------------------------------ */
-static void send_file_contents(const char *filename, int connfd) {
-    int fd = open(filename, O_RDONLY);
-    if (fd < 0) {
+static void send_file_contents(const char *filename, sem_t *lock, int connfd) {
+    FileSnapshot snap;
+    sem_wait(lock);
+    int rc = snapshot_open(filename, &snap);
+    sem_post(lock);
+    if (rc < 0) {
         send_message(connfd, "File not found or error opening file.\n");
         return;
     }
 
-    // read and send in chunks (safe for larger files)
-    char buf[512];
-    ssize_t n;
-    // we'll gather lines and send them; simpler: send chunk as-is
-    // but to keep messages readable, send per read()
-    while ((n = read(fd, buf, sizeof(buf))) > 0) {
-        // write chunk to client (may split lines) — acceptable for viewing
-        // ensure null termination for send_message usage
-        char tmp[513];
-        memcpy(tmp, buf, n);
-        tmp[n] = '\0';
-        send_message(connfd, tmp);
-    }
-    close(fd);
+    if (send_snapshot(connfd, &snap) == -1)
+        perror("Send failed");
+    snapshot_close(&snap);
 }
 
 /* ------------------------------------------------------------
    1) View All Customers (read-only)
    ------------------------------------------------------------ */
 static void view_all_customers(int connfd) {
-    sem_wait(sem_userdb);
     send_message(connfd, "----- All Customers -----\n");
-    send_file_contents("customer.txt", connfd);
+    send_file_contents("customer.txt", sem_userdb, connfd);
     send_message(connfd, "\n----- End of Customers -----\n");
-    sem_post(sem_userdb);
+}
+
+typedef struct {
+    const char *username;
+    int active;
+} ActiveEdit;
+
+static int edit_customer_active(Record *r, void *ctx) {
+    ActiveEdit *e = ctx;
+    if (!rf_eq(r, USER_NAME, e->username)) return RF_KEEP;
+    rf_set_int(r, USER_ACTIVE, e->active);
+    if (r->ncols > USER_LOGGED_IN)
+        rf_set_int(r, USER_LOGGED_IN, 0);    // always force logout if changed
+    return RF_CHANGED;
 }
 
 /* ------------------------------------------------------------
@@ -60,12 +67,6 @@ static void view_all_customers(int connfd) {
    ------------------------------------------------------------ */
 static void toggle_customer_active(int connfd) {
     char username[64], active_str[8];
-    char temp_file[] = "temp_customer.txt";
-    char buffer[512];
-    int fd_read = -1, fd_write = -1;
-    int found = 0;
-    ssize_t bytes;
-    int pos = 0;
 
     send_message(connfd, "Enter customer username to modify: ");
     if (receive_message(connfd, username, sizeof(username)) <= 0) return;
@@ -77,78 +78,20 @@ static void toggle_customer_active(int connfd) {
     int new_active = atoi(active_str);
     if (new_active != 0 && new_active != 1) new_active = 1; // default
 
+    ActiveEdit e = { username, new_active };
     sem_wait(sem_userdb);
+    int n = rf_update(&rf_customer, edit_customer_active, &e);
+    sem_post(sem_userdb);
 
-    fd_read = open("customer.txt", O_RDONLY);
-    if (fd_read < 0) {
-        sem_post(sem_userdb);
-        send_message(connfd, "Error opening customer file.\n");
-        return;
-    }
-
-    fd_write = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_write < 0) {
-        close(fd_read);
-        sem_post(sem_userdb);
-        send_message(connfd, "Error creating temporary file.\n");
-        return;
-    }
-
-    char line[512];
-    pos = 0;
-    while ((bytes = read(fd_read, buffer, sizeof(buffer))) > 0) {
-        for (ssize_t i = 0; i < bytes; i++) {
-            if (buffer[i] == '\n' || pos >= (int)sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-
-                if (strlen(line) == 0) continue;
-
-                int id, active, logged_in;
-                char file_username[128], file_password[128];
-
-                // ✅ Parse 5 fields instead of 4
-                int parsed = sscanf(line, "%d %127s %127s %d %d",
-                                    &id, file_username, file_password, &active, &logged_in);
-
-                if (parsed == 5 && strcmp(file_username, username) == 0) {
-                    found = 1;
-                    logged_in = 0; // always force logout if changed
-                    char newline[512];
-                    snprintf(newline, sizeof(newline),
-                             "%d %s %s %d %d\n", id, file_username, file_password,
-                             new_active, logged_in);
-                    write(fd_write, newline, strlen(newline));
-                } else if (parsed >= 4) {
-                    // Preserve rest of file safely
-                    write(fd_write, line, strlen(line));
-                    write(fd_write, "\n", 1);
-                }
-            } else {
-                line[pos++] = buffer[i];
-            }
-        }
-    }
-
-    close(fd_read);
-    close(fd_write);
-
-    if (found) {
-        if (rename(temp_file, "customer.txt") != 0) {
-            send_message(connfd, "Error updating customer file.\n");
-            unlink(temp_file);
-        } else {
-            send_message(connfd, "✅ Customer active status updated.\n");
-        }
-    } else {
-        unlink(temp_file);
+    if (n > 0)
+        send_message(connfd, "✅ Customer active status updated.\n");
+    else if (n == 0)
         send_message(connfd, "❌ Customer not found.\n");
-    }
-
-    sem_post(sem_userdb);
+    else
+        send_message(connfd, "Error updating customer file.\n");
 
     // ✅ If deactivated, disconnect live customer process if any
-    if (found && new_active == 0) {
+    if (n > 0 && new_active == 0) {
         // Optional system broadcast (only works if you track sessions)
         // You can also just print:
         printf("[INFO] Customer '%s' was deactivated — should be logged out.\n", username);
@@ -156,20 +99,27 @@ static void toggle_customer_active(int connfd) {
 }
 
 
+typedef struct {
+    const char *loan_id;
+    const char *employee;
+} LoanAssignEdit;
+
+static int edit_loan_assignment(Record *r, void *ctx) {
+    LoanAssignEdit *e = ctx;
+    if (!rf_eq(r, LOAN_ID, e->loan_id)) return RF_KEEP;
+    rf_set_str(r, LOAN_EMPLOYEE, e->employee);
+    rf_set_str(r, LOAN_STATUS, "assigned");
+    return RF_CHANGED;
+}
+
 /* ------------------------------------------------------------
    3) Assign Loan Application Processes to Employees
    - Simple format expected in loan_db.txt:
-     <loan_id> <customer_username> <amount> <status> <assigned_employee>
+     <loan_id> <customer_username> <amount> <assigned_employee> <status>
    - status examples: pending, assigned, approved, rejected
    ------------------------------------------------------------ */
 static void assign_loan_to_employee(int connfd) {
     char loan_id_str[32], emp_username[64];
-    char temp_file[] = "temp_loans.txt";
-    char buffer[512];
-    int fd_read = -1, fd_write = -1;
-    int found = 0;
-    ssize_t bytes;
-    int pos = 0;
 
     // ask loan id and employee
     send_message(connfd, "Enter loan id to assign: ");
@@ -182,131 +132,25 @@ static void assign_loan_to_employee(int connfd) {
 
     // Verify employee exists
     sem_wait(sem_userdb);
-    int emp_exists = 0;
-    int efd = open("employee.txt", O_RDONLY);
-    if (efd >= 0) {
-        ssize_t n2;
-        int p2 = 0;
-        char buf2[512], line2[256];
-        while ((n2 = read(efd, buf2, sizeof(buf2))) > 0) {
-            for (ssize_t i=0;i<n2;i++) {
-                if (buf2[i] == '\n' || p2 >= (int)sizeof(line2)-1) {
-                    line2[p2] = '\0';
-                    p2 = 0;
-                    // parse username token
-                    char copy[256];
-                    strncpy(copy, line2, sizeof(copy)-1);
-                    copy[sizeof(copy)-1] = '\0';
-                    char *t = strtok(copy, " "); // id
-                    t = strtok(NULL, " "); // username
-                    if (t && strcmp(t, emp_username) == 0) { emp_exists = 1; break; }
-                } else line2[p2++] = buf2[i];
-            }
-            if (emp_exists) break;
-        }
-        close(efd);
-    }
+    int emp_exists = rf_find(&rf_employee, USER_NAME, emp_username, NULL) == 1;
+    sem_post(sem_userdb);
     if (!emp_exists) {
-        sem_post(sem_userdb);
         send_message(connfd, "Employee not found.\n");
         return;
     }
-    sem_post(sem_userdb);
-
-    // lock loan file (account semaphore) and perform update
-    sem_wait(sem_account);
-
-    fd_read = open("loan_db.txt", O_RDONLY);
-    if (fd_read < 0) {
-        sem_post(sem_account);
-        send_message(connfd, "No loan database found or error opening.\n");
-        return;
-    }
-
-    fd_write = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_write < 0) {
-        close(fd_read);
-        sem_post(sem_account);
-        send_message(connfd, "Error creating temp loan file.\n");
-        return;
-    }
-
-    // parse loan_db line-by-line, update matching loan_id
-    char line[512];
-    pos = 0;
-    while ((bytes = read(fd_read, buffer, sizeof(buffer))) > 0) {
-        for (ssize_t i=0;i<bytes;i++) {
-            if (buffer[i] == '\n' || pos >= (int)sizeof(line)-1) {
-                line[pos] = '\0';
-                pos = 0;
-
-                // make copy for safe tokenizing
-                char copy[512];
-                strncpy(copy, line, sizeof(copy)-1);
-                copy[sizeof(copy)-1] = '\0';
-
-                char *tok = strtok(copy, " ");
-                if (!tok) {
-                    // write unchanged
-                    write(fd_write, line, strlen(line));
-                    write(fd_write, "\n", 1);
-                    continue;
-                }
-                char loanid_chk[64];
-                strncpy(loanid_chk, tok, sizeof(loanid_chk)-1);
-                loanid_chk[sizeof(loanid_chk)-1] = '\0';
-
-                // compare ids
-                if (strcmp(loanid_chk, loan_id_str) == 0) {
-                    // parse customer, amount, status, assigned
-                    char *cust = strtok(NULL, " ");
-                    char *amt = strtok(NULL, " ");
-                    // status
-                    char *status = strtok(NULL, " ");
-                    // assigned
-                    char *assigned = strtok(NULL, " ");
-
-                    // build updated line: loan_id customer amount assigned status(assigned)
-                    // we'll write: loan_id customer amount assigned_employee assigned
-                    write(fd_write, loanid_chk, strlen(loanid_chk));
-                    write(fd_write, " ", 1);
-                    if (cust) { write(fd_write, cust, strlen(cust)); write(fd_write, " ",1); }
-                    if (amt) { write(fd_write, amt, strlen(amt)); write(fd_write, " ",1); }
-                    // assigned employee username
-                    write(fd_write, emp_username, strlen(emp_username));
-                    write(fd_write, " ", 1);
-                    // status
-                    write(fd_write, "assigned", strlen("assigned"));
-                    write(fd_write, "\n", 1);
-
-                    found = 1;
-                } else {
-                    // not target loan -> copy unchanged
-                    write(fd_write, line, strlen(line));
-                    write(fd_write, "\n", 1);
-                }
-            } else {
-                line[pos++] = buffer[i];
-            }
-        }
-    }
 
-    close(fd_read);
-    close(fd_write);
+    // lock loan file and perform update
+    LoanAssignEdit e = { loan_id_str, emp_username };
+    sem_wait(sem_loan);
+    int n = rf_update(&rf_loan, edit_loan_assignment, &e);
+    sem_post(sem_loan);
 
-    if (found) {
-        if (rename(temp_file, "loan_db.txt") != 0) {
-            send_message(connfd, "Error finalizing loan update.\n");
-            unlink(temp_file);
-        } else {
-            send_message(connfd, "Loan assigned to employee successfully.\n");
-        }
-    } else {
-        unlink(temp_file);
+    if (n > 0)
+        send_message(connfd, "Loan assigned to employee successfully.\n");
+    else if (n == 0)
         send_message(connfd, "Loan id not found.\n");
-    }
-
-    sem_post(sem_account);
+    else
+        send_message(connfd, "Error finalizing loan update.\n");
 }
 
 /* ------------------------------------------------------------
@@ -314,11 +158,9 @@ static void assign_loan_to_employee(int connfd) {
    - Simply display feedback_db.txt to manager
    ------------------------------------------------------------ */
 static void review_customer_feedback(int connfd) {
-    sem_wait(sem_account); // protect feedback file
     send_message(connfd, "----- Customer Feedback -----\n");
-    send_file_contents("feedback_db.txt", connfd);
+    send_file_contents("feedback_db.txt", sem_userdb, connfd);  // add_feedback appends under sem_userdb
     send_message(connfd, "\n----- End of Feedback -----\n");
-    sem_post(sem_account);
 }
 
 /* ------------------------------------------------------------
@@ -327,12 +169,6 @@ static void review_customer_feedback(int connfd) {
    ------------------------------------------------------------ */
 static void change_manager_password(int connfd) {
     char username[64], old_pass[64], new_pass[64];
-    char buffer[512], line[256];
-    char temp_file[] = "temp_manager.txt";
-    int fd_read = -1, fd_write = -1;
-    ssize_t bytes;
-    int pos = 0;
-    int found = 0;
 
     send_message(connfd, "Enter your manager username: ");
     if (receive_message(connfd, username, sizeof(username)) <= 0) return;
@@ -347,100 +183,54 @@ static void change_manager_password(int connfd) {
     trim_newline(new_pass);
 
     sem_wait(sem_userdb);
+    int n = rf_change_password(&rf_manager, username, old_pass, new_pass, NULL);
+    sem_post(sem_userdb);
 
-    fd_read = open("manager.txt", O_RDONLY);
-    if (fd_read < 0) {
-        sem_post(sem_userdb);
-        send_message(connfd, "Error opening manager file.\n");
-        return;
-    }
-
-    fd_write = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_write < 0) {
-        close(fd_read);
-        sem_post(sem_userdb);
-        send_message(connfd, "Error creating temp file.\n");
-        return;
-    }
-
-    pos = 0;
-    while ((bytes = read(fd_read, buffer, sizeof(buffer))) > 0) {
-        for (ssize_t i=0;i<bytes;i++) {
-            if (buffer[i] == '\n' || pos >= (int)sizeof(line)-1) {
-                line[pos] = '\0';
-                pos = 0;
-
-                // parse copy
-                char copy[256];
-                strncpy(copy, line, sizeof(copy)-1);
-                copy[sizeof(copy)-1] = '\0';
-
-                char *tok = strtok(copy, " ");
-                if (!tok) { // malformed
-                    write(fd_write, line, strlen(line)); write(fd_write, "\n",1);
-                    continue;
-                }
-                int id = atoi(tok);
-
-                tok = strtok(NULL, " ");
-                if (!tok) { write(fd_write, line, strlen(line)); write(fd_write, "\n",1); continue; }
-                char file_username[128];
-                strncpy(file_username, tok, sizeof(file_username)-1);
-                file_username[sizeof(file_username)-1] = '\0';
-
-                tok = strtok(NULL, " ");
-                if (!tok) { write(fd_write, line, strlen(line)); write(fd_write, "\n",1); continue; }
-                char file_password[128];
-                strncpy(file_password, tok, sizeof(file_password)-1);
-                file_password[sizeof(file_password)-1] = '\0';
-
-                tok = strtok(NULL, " ");
-                if (!tok) { write(fd_write, line, strlen(line)); write(fd_write, "\n",1); continue; }
-                int active = atoi(tok);
-
-                if (strcmp(file_username, username) == 0 && strcmp(file_password, old_pass) == 0) {
-                    found = 1;
-                    // write updated record
-                    char id_buf[16], act_buf[8];
-                    snprintf(id_buf, sizeof(id_buf), "%d", id);
-                    snprintf(act_buf, sizeof(act_buf), "%d", active);
-
-                    write(fd_write, id_buf, strlen(id_buf));
-                    write(fd_write, " ", 1);
-                    write(fd_write, file_username, strlen(file_username));
-                    write(fd_write, " ", 1);
-                    write(fd_write, new_pass, strlen(new_pass));
-                    write(fd_write, " ", 1);
-                    write(fd_write, act_buf, strlen(act_buf));
-                    write(fd_write, "\n", 1);
-                } else {
-                    // copy as-is
-                    write(fd_write, line, strlen(line));
-                    write(fd_write, "\n", 1);
-                }
-
-            } else {
-                line[pos++] = buffer[i];
-            }
-        }
-    }
+    if (n > 0)
+        send_message(connfd, "Manager password updated successfully.\n");
+    else if (n == 0)
+        send_message(connfd, "Invalid username or password.\n");
+    else
+        send_message(connfd, "Error updating manager password.\n");
+}
 
-    close(fd_read);
-    close(fd_write);
+/* ledger_scan_range() callback: one row of the daily report */
+static int send_ledger_report_row(const LedgerRecord *rec, void *ctx) {
+    int connfd = *(int *)ctx;
+    char when[32], msg[512];
+
+    ledger_format_time(rec->timestamp, when, sizeof(when));
+    snprintf(msg, sizeof(msg),
+             "Txn ID: %d | User: %s | Type: %s | Amount: %.2f | Time: %s | Balance: %.2f\n",
+             rec->tx.tx_id, rec->username, ledger_type_name(rec->tx.tx_type),
+             rec->tx.amount, when, rec->balance);
+    return send_message(connfd, msg) == -1 ? -1 : 0;
+}
 
-    if (found) {
-        if (rename(temp_file, "manager.txt") != 0) {
-            send_message(connfd, "Error updating manager password.\n");
-            unlink(temp_file);
-        } else {
-            send_message(connfd, "Manager password updated successfully.\n");
+/* ------------------------------------------------------------
+   All transactions between two dates. Only the ledger segments
+   (months) overlapping the range are read.
+   ------------------------------------------------------------ */
+void view_transactions_by_date(int connfd) {
+    char input[32];
+    int day[2];
+    const char *prompt[2] = { "From date (YYYY-MM-DD): ", "To date (YYYY-MM-DD): " };
+
+    for (int i = 0; i < 2; i++) {
+        int y, m, d;
+        send_message(connfd, prompt[i]);
+        if (receive_message(connfd, input, sizeof(input)) <= 0) return;
+        if (sscanf(input, "%d-%d-%d", &y, &m, &d) != 3 || m < 1 || m > 12 || d < 1 || d > 31) {
+            send_message(connfd, "Invalid date.\n");
+            return;
         }
-    } else {
-        unlink(temp_file);
-        send_message(connfd, "Invalid username or password.\n");
+        day[i] = y * 10000 + m * 100 + d;
     }
 
-    sem_post(sem_userdb);
+    if (ledger_scan_range(day[0], day[1], send_ledger_report_row, &connfd) > 0)
+        send_message(connfd, "---- End of Transactions ----\n");
+    else
+        send_message(connfd, "No transactions in that period.\n");
 }
 
 /* ------------------------------------------------------------
@@ -464,11 +254,13 @@ void manager_menu(int connfd, const char *username){
             "5. Change Password\n"
             "6. Logout\n"
             "7. Exit\n"
+            "8. View Transactions by Date\n"
             "Enter your choice: "
         );
 
         if (receive_message(connfd, choice_str, sizeof(choice_str)) <= 0)
             return;
+        session_touch();
         trim_newline(choice_str);
         choice = atoi(choice_str);
 
@@ -494,9 +286,12 @@ void manager_menu(int connfd, const char *username){
             case 7:
                 send_message(connfd, "Exiting system...\n");
                 sem_wait(sem_userdb);
-                mark_user_logged_out("manager.txt", username);
+                session_end();
                 sem_post(sem_userdb);
-                _exit(0);
+                client_exit(connfd);
+            case 8:
+                view_transactions_by_date(connfd);
+                break;
             default:
                 send_message(connfd, "Invalid choice. Try again.\n");
                 break;
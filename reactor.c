@@ -0,0 +1,296 @@
+/* reactor.c
+   Event-driven server mode: server --reactor [workers]
+
+   Instead of a process per connection, one thread runs an epoll loop
+   over the listening socket and every client socket, and a fixed pool
+   of worker threads does the CPU and disk work. Each connection is a
+   session coroutine (ucontext) running the same menu code as the fork
+   server. Client sockets are non-blocking: when receive_message()
+   finds no input, or a reply finds the socket buffer full, it parks
+   the coroutine; its socket is re-armed (EPOLLONESHOT) for EPOLLIN
+   or EPOLLOUT and the worker moves on to the next ready session.
+
+   A session stays on the worker it was given at accept time, so
+   thread-local state (ledger segment cache, scan buffers, the
+   account lock fd, current_session) never changes under it, but
+   other sessions run on the same thread while it is parked. Nothing
+   may stay locked, and no thread buffer stay in use, across a
+   receive_message() or a send.
+   Designed to be included directly into server.c (no header).
+*/
+
+#include "utils.h"
+#include "Struct.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#define REACTOR_WORKERS       8                  // default pool size
+#define REACTOR_MAX_WORKERS   256
+#define REACTOR_STACK         (256 * 1024)       // per session; only touched pages use memory
+#define REACTOR_EVENTS        256
+
+typedef struct ReactorConn {
+    int fd;
+    int worker;                      // pinned to this worker
+    int session;                     // current_session while parked
+    int done;                        // finished: free once switched out
+    uint32_t events;                 // what the parked session waits for
+    ucontext_t ctx;
+    char *stack;
+    struct ReactorConn *next;        // worker run queue
+} ReactorConn;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    ReactorConn *head, *tail;        // sessions ready to run
+    ucontext_t sched;                // where parked sessions switch back to
+    int nconns;                      // sessions pinned here (atomic)
+} ReactorWorker;
+
+static ReactorWorker *reactor_workers = NULL;
+static int reactor_nworkers = 0;
+static int reactor_epfd = -1;
+static void (*reactor_serve)(int connfd) = NULL;
+static __thread ReactorConn *reactor_current = NULL;   // session running on this thread
+
+static void reactor_enqueue(ReactorConn *c) {
+    ReactorWorker *w = &reactor_workers[c->worker];
+    c->next = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->tail) w->tail->next = c;
+    else w->head = c;
+    w->tail = c;
+    pthread_cond_signal(&w->ready);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Park the running session until its socket has 'events' (EPOLLIN
+   or EPOLLOUT). Outside a session (startup code) just block. */
+static int reactor_wait(int fd, uint32_t events) {
+    ReactorConn *c = reactor_current;
+    if (!c) {
+        struct pollfd p = { fd, events == EPOLLIN ? POLLIN : POLLOUT, 0 };
+        return poll(&p, 1, -1) == -1 && errno != EINTR ? -1 : 0;
+    }
+    c->events = events;
+    swapcontext(&c->ctx, &reactor_workers[c->worker].sched);
+    return 0;
+}
+
+/* receive_message() hook */
+static int reactor_wait_readable(int fd) {
+    return reactor_wait(fd, EPOLLIN);
+}
+
+/* Send hook: a client that stops reading parks only its own session */
+static int reactor_wait_writable(int fd) {
+    return reactor_wait(fd, EPOLLOUT);
+}
+
+/* Close the session's socket and leave its coroutine for good */
+static __attribute__((noreturn)) void reactor_finish(ReactorConn *c) {
+    close(c->fd);
+    c->done = 1;
+    swapcontext(&c->ctx, &reactor_workers[c->worker].sched);
+    abort();                         // a finished session is never resumed
+}
+
+static void reactor_session_main(void) {
+    ReactorConn *c = reactor_current;
+    reactor_serve(c->fd);
+    reactor_finish(c);
+}
+
+static sigjmp_buf *client_exit_jmp = NULL;   // set by a prefork worker around each session
+
+/* ------------------------------------------------------------
+   End the client's connection from inside a menu ("Exit"): the
+   fork server's child exits, a reactor session just finishes and
+   a prefork worker goes back to its accept loop. Output still
+   held for the client is sent first.
+   ------------------------------------------------------------ */
+__attribute__((noreturn)) void client_exit(int connfd) {
+    message_flush(connfd);
+    if (reactor_current) reactor_finish(reactor_current);
+    if (client_exit_jmp) siglongjmp(*client_exit_jmp, 1);
+    _exit(0);
+}
+
+static void reactor_free(ReactorConn *c) {
+    munmap(c->stack, REACTOR_STACK);
+    __atomic_fetch_sub(&reactor_workers[c->worker].nconns, 1, __ATOMIC_RELAXED);
+    free(c);
+}
+
+static void *reactor_worker_main(void *arg) {
+    ReactorWorker *w = arg;
+    while (1) {
+        pthread_mutex_lock(&w->lock);
+        while (!w->head)
+            pthread_cond_wait(&w->ready, &w->lock);
+        ReactorConn *c = w->head;
+        w->head = c->next;
+        if (!w->head) w->tail = NULL;
+        pthread_mutex_unlock(&w->lock);
+
+        // Run the session until it waits for input or ends
+        reactor_current = c;
+        current_session = c->session;
+        swapcontext(&w->sched, &c->ctx);
+        c->session = current_session;
+        current_session = -1;
+        reactor_current = NULL;
+
+        if (c->done) {
+            reactor_free(c);
+            continue;
+        }
+        // Armed only now that the coroutine is off this stack. A peer
+        // that hung up reports EPOLLHUP/EPOLLERR to a writer anyway;
+        // EPOLLRDHUP is only asked for by readers, or a half-closed
+        // peer would wake a writer waiting for room over and over.
+        struct epoll_event ev;
+        ev.events = c->events | EPOLLONESHOT;
+        if (c->events == EPOLLIN) ev.events |= EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(reactor_epfd, EPOLL_CTL_MOD, c->fd, &ev) == -1) {
+            perror("epoll_ctl");
+            shutdown(c->fd, SHUT_RDWR);     // the session sees EOF and ends
+            reactor_enqueue(c);
+        }
+    }
+    return NULL;
+}
+
+/* New connection: give it a stack and the least busy worker */
+static void reactor_accept(int fd) {
+    ReactorConn *c = calloc(1, sizeof(*c));
+    char *stack = mmap(NULL, REACTOR_STACK, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (!c || stack == MAP_FAILED) {
+        perror("reactor session");
+        free(c);
+        if (stack != MAP_FAILED) munmap(stack, REACTOR_STACK);
+        close(fd);
+        return;
+    }
+    mprotect(stack, sysconf(_SC_PAGESIZE), PROT_NONE);   // guard page
+
+    int best = 0;
+    for (int i = 1; i < reactor_nworkers; i++)
+        if (reactor_workers[i].nconns < reactor_workers[best].nconns) best = i;
+
+    c->fd = fd;
+    c->worker = best;
+    c->session = -1;
+    c->stack = stack;
+    getcontext(&c->ctx);
+    c->ctx.uc_stack.ss_sp = stack;
+    c->ctx.uc_stack.ss_size = REACTOR_STACK;
+    c->ctx.uc_link = NULL;
+    makecontext(&c->ctx, reactor_session_main, 0);
+
+    // Registered disarmed; the worker arms it when the session first waits
+    struct epoll_event ev;
+    ev.events = EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(reactor_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("epoll_ctl add");
+        munmap(stack, REACTOR_STACK);
+        free(c);
+        close(fd);
+        return;
+    }
+    __atomic_fetch_add(&reactor_workers[best].nconns, 1, __ATOMIC_RELAXED);
+    reactor_enqueue(c);              // runs the login prompt
+}
+
+/* ------------------------------------------------------------
+   Serve listenfd with an epoll loop and 'nworkers' worker threads,
+   running serve(connfd) as a coroutine per connection. Signals are
+   taken by the epoll thread only; on_signal (if set) runs there
+   after each one.
+   Returns only if the reactor cannot be set up.
+   ------------------------------------------------------------ */
+int reactor_run(int listenfd, int nworkers, void (*serve)(int connfd), void (*on_signal)(void)) {
+    if (nworkers < 1) nworkers = REACTOR_WORKERS;
+    if (nworkers > REACTOR_MAX_WORKERS) nworkers = REACTOR_MAX_WORKERS;
+
+    signal(SIGPIPE, SIG_IGN);        // a dead client must not kill every session
+    fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+
+    reactor_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor_epfd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;              // NULL = the listening socket
+    if (epoll_ctl(reactor_epfd, EPOLL_CTL_ADD, listenfd, &ev) == -1) {
+        perror("epoll_ctl listen");
+        return -1;
+    }
+
+    reactor_serve = serve;
+    set_receive_wait(reactor_wait_readable);
+    set_send_wait(reactor_wait_writable);
+    reactor_workers = calloc(nworkers, sizeof(ReactorWorker));
+    if (!reactor_workers) return -1;
+    reactor_nworkers = nworkers;
+
+    // Workers start with SIGCHLD blocked, so epoll_wait() sees it
+    sigset_t chld, old;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &chld, &old);
+    for (int i = 0; i < nworkers; i++) {
+        pthread_mutex_init(&reactor_workers[i].lock, NULL);
+        pthread_cond_init(&reactor_workers[i].ready, NULL);
+        if (pthread_create(&reactor_workers[i].thread, NULL, reactor_worker_main, &reactor_workers[i]) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    printf("Reactor: %d worker threads\n", nworkers);
+    fflush(stdout);
+
+    struct epoll_event events[REACTOR_EVENTS];
+    while (1) {
+        int n = epoll_wait(reactor_epfd, events, REACTOR_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                if (on_signal) on_signal();
+                continue;
+            }
+            perror("epoll_wait");
+            return -1;
+        }
+        for (int i = 0; i < n; i++) {
+            ReactorConn *c = events[i].data.ptr;
+            if (c) {
+                reactor_enqueue(c);
+                continue;
+            }
+            int fd;
+            while ((fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) != -1)
+                reactor_accept(fd);
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("accept");
+        }
+    }
+}
@@ -0,0 +1,354 @@
+/* record_file.c
+   One engine for the space-separated text databases: the role files
+   (admin.txt, manager.txt, employee.txt, customer.txt), loan_db.txt
+   and feedback_db.txt.
+
+   Each file is described by a RecSchema (column types, the lock that
+   serializes its writers, its temp file). Records are parsed into a
+   Record: one (pointer, length) view per column plus the value of
+   every integer column. On top of that:
+   - rf_find():   point lookup on any column;
+   - rf_scan():   predicate scan over a snapshot, no lock held;
+   - rf_update(): one rewrite pass in which a callback keeps, edits
+                  or drops records, however many; the file is
+                  replaced by rename() only if something changed;
+   - rf_append(): add a record at the end.
+   Lines that do not fit the schema are never handed to callbacks
+   and are copied through rewrites unchanged.
+
+   Accounts and the transaction ledger are binary (account_store.c,
+   ledger.c) and have their own lookup and scan functions.
+   Designed to be included directly into server.c (no header).
+*/
+
+#include "utils.h"
+#include "Struct.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <semaphore.h>
+
+extern sem_t *sem_userdb;
+extern sem_t *sem_loan;
+
+#define RF_MAX_COLS   8
+#define RF_LINE_MAX   512                // longest record written or returned
+#define RF_OUT_BUF    65536              // rewrite output buffer
+
+typedef enum {
+    RF_INT,                          // decimal integer
+    RF_STR,                          // one word
+    RF_TEXT                          // rest of the line (last column only)
+} RfType;
+
+typedef struct {
+    const char *file;
+    const char *tmp_file;            // temp_*.txt: removed by crash recovery
+    sem_t **lock;                    // serializes writers of the file
+    int ncols;                       // columns in a full record
+    int min_cols;                    // fewer than this: not a record
+    RfType type[RF_MAX_COLS];
+} RecSchema;
+
+typedef struct {
+    int ncols;                       // columns present
+    RecField col[RF_MAX_COLS];
+    int num[RF_MAX_COLS];            // value of each RF_INT column
+    char scratch[RF_MAX_COLS][16];   // text of integers set by rf_set_int()
+    char line[RF_LINE_MAX];          // owned copy (rf_find)
+} Record;
+
+// Role files: <id> <username> <password> <active> [<logged_in>]
+enum { USER_ID, USER_NAME, USER_PASS, USER_ACTIVE, USER_LOGGED_IN };
+// loan_db.txt: <loan_id> <customer> <amount> <employee> <status>
+enum { LOAN_ID, LOAN_CUSTOMER, LOAN_AMOUNT, LOAN_EMPLOYEE, LOAN_STATUS };
+// feedback_db.txt: <id> <username> <text...>
+enum { FEEDBACK_ID, FEEDBACK_USER, FEEDBACK_TEXT };
+
+#define RF_USER_SCHEMA(name, tmp) \
+    { name, tmp, &sem_userdb, 5, 4, { RF_INT, RF_STR, RF_STR, RF_INT, RF_INT } }
+
+static const RecSchema rf_admin    = RF_USER_SCHEMA("admin.txt", "temp_admin.txt");
+static const RecSchema rf_manager  = RF_USER_SCHEMA("manager.txt", "temp_manager.txt");
+static const RecSchema rf_employee = RF_USER_SCHEMA("employee.txt", "temp_employee.txt");
+static const RecSchema rf_customer = RF_USER_SCHEMA("customer.txt", "temp_customer.txt");
+
+static const RecSchema rf_loan = {
+    "loan_db.txt", "temp_loan_db.txt", &sem_loan, 5, 5,
+    { RF_INT, RF_STR, RF_INT, RF_STR, RF_STR }
+};
+
+static const RecSchema rf_feedback = {
+    "feedback_db.txt", "temp_feedback_db.txt", &sem_userdb, 3, 3,
+    { RF_INT, RF_STR, RF_TEXT }
+};
+
+/* Callback results for rf_update() */
+#define RF_KEEP     0                // write the record back as it was
+#define RF_CHANGED  1                // write the record as edited
+#define RF_DROP     2                // leave the record out
+
+typedef int (*RfVisit)(const Record *r, void *ctx);   // nonzero: stop
+typedef int (*RfEdit)(Record *r, void *ctx);          // RF_KEEP/CHANGED/DROP
+
+/* ---- Record access ---- */
+
+static int rf_int(const Record *r, int col) {
+    return r->num[col];
+}
+
+static int rf_eq(const Record *r, int col, const char *s) {
+    return col < r->ncols && rec_eq(r->col[col], s);
+}
+
+/* Setters keep a view of 's', which must outlive the write */
+static void rf_set_str(Record *r, int col, const char *s) {
+    r->col[col].p = s;
+    r->col[col].len = (int)strlen(s);
+}
+
+static void rf_set_int(Record *r, int col, int v) {
+    r->num[col] = v;
+    r->col[col].p = r->scratch[col];
+    r->col[col].len = snprintf(r->scratch[col], sizeof(r->scratch[col]), "%d", v);
+}
+
+/* Start a new record with ncols columns, to be filled by the setters */
+static void rf_init(Record *r, int ncols) {
+    memset(r->col, 0, sizeof(r->col));
+    memset(r->num, 0, sizeof(r->num));
+    r->ncols = ncols;
+}
+
+/* Line -> record. The fields point into 'line'. -1 if it does not fit. */
+static int rf_parse(const RecSchema *s, const char *line, size_t len, Record *r) {
+    int n = rec_split(line, len, r->col, s->ncols);
+    if (n < s->min_cols) return -1;
+
+    for (int c = 0; c < n; c++) {
+        if (s->type[c] == RF_INT && rec_int(r->col[c], &r->num[c]) == -1)
+            return -1;
+        if (s->type[c] == RF_TEXT) {             // runs to the end of the line
+            size_t end = len;
+            while (end > 0 && (line[end - 1] == '\r' || line[end - 1] == ' ')) end--;
+            r->col[c].len = (int)(end - (size_t)(r->col[c].p - line));
+        }
+    }
+    r->ncols = n;
+    return 0;
+}
+
+/* Record -> "<col> <col> ...\n"; -1 if it does not fit in buf */
+static int rf_format(const Record *r, char *buf, size_t cap) {
+    size_t len = 0;
+    for (int c = 0; c < r->ncols; c++) {
+        int n = snprintf(buf + len, cap - len, "%s%.*s", c ? " " : "", r->col[c].len, r->col[c].p);
+        if (n < 0 || len + n + 1 >= cap) return -1;  // keep room for '\n'
+        len += n;
+    }
+    buf[len++] = '\n';
+    return (int)len;
+}
+
+/* ------------------------------------------------------------
+   Predicate scan over a snapshot of the file. The schema's lock
+   is taken only around the open, so the caller must not hold it
+   and 'fn' may talk to the client. -1 if the file cannot be read.
+   ------------------------------------------------------------ */
+static int rf_scan(const RecSchema *s, RfVisit fn, void *ctx) {
+    FileSnapshot snap;
+    sem_wait(*s->lock);
+    int rc = snapshot_open(s->file, &snap);
+    sem_post(*s->lock);
+    if (rc < 0) return -1;
+
+    Record r;
+    char *line;
+    size_t len;
+    while ((line = snapshot_next_line(&snap, &len)) != NULL) {
+        if (rf_parse(s, line, len, &r) == 0 && fn(&r, ctx))
+            break;
+    }
+    snapshot_close(&snap);
+    return 0;
+}
+
+/* ------------------------------------------------------------
+   Point lookup: first record whose column 'col' equals 'value',
+   copied to 'out' if not NULL. Caller holds the schema's lock.
+   Returns 1 if found, 0 if not (or no file), -1 on read error.
+   ------------------------------------------------------------ */
+static int rf_find(const RecSchema *s, int col, const char *value, Record *out) {
+    int fd = open(s->file, O_RDONLY);
+    if (fd == -1) return errno == ENOENT ? 0 : -1;
+
+    static __thread LineReader lr;
+    Record r;
+    char *line;
+    size_t len;
+    int found = 0;
+    line_reader_init(&lr, fd, 0, -1);
+    while (!found && (line = line_reader_next(&lr, &len)) != NULL) {
+        if (rf_parse(s, line, len, &r) == -1 || !rf_eq(&r, col, value)) continue;
+        found = 1;
+        if (out) {                               // re-parse from an owned copy
+            if (len >= sizeof(out->line)) len = sizeof(out->line) - 1;
+            memcpy(out->line, line, len);
+            out->line[len] = '\0';
+            rf_parse(s, out->line, len, out);
+        }
+    }
+    close(fd);
+    return found;
+}
+
+/* ------------------------------------------------------------
+   Append a record. Caller holds the schema's lock.
+   ------------------------------------------------------------ */
+static int rf_append(const RecSchema *s, const Record *r) {
+    char buf[RF_LINE_MAX];
+    int len = rf_format(r, buf, sizeof(buf));
+    if (len == -1) return -1;
+
+    int fd = open(s->file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1) return -1;
+    int ok = write(fd, buf, len) == len;
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+typedef struct {
+    int fd;
+    int len;
+    int failed;
+    char buf[RF_OUT_BUF];
+} RfOut;
+
+static void rf_out_flush(RfOut *o) {
+    if (o->len > 0 && write(o->fd, o->buf, o->len) != o->len) o->failed = 1;
+    o->len = 0;
+}
+
+static void rf_out_put(RfOut *o, const char *p, size_t n) {
+    if (o->len + n > sizeof(o->buf)) rf_out_flush(o);
+    if (n > sizeof(o->buf)) {                    // longer than the buffer: write through
+        if (write(o->fd, p, n) != (ssize_t)n) o->failed = 1;
+        return;
+    }
+    memcpy(o->buf + o->len, p, n);
+    o->len += n;
+}
+
+/* ------------------------------------------------------------
+   Rewrite the file in one pass. 'fn' sees every record and
+   returns RF_KEEP, RF_CHANGED (after editing it with the setters)
+   or RF_DROP; lines that are not records are kept as they are.
+   The file is replaced only if some record changed or was dropped,
+   and a role file's user directory is invalidated.
+   Caller holds the schema's lock.
+   Returns the number of records changed or dropped, -1 on error.
+   ------------------------------------------------------------ */
+static int rf_update(const RecSchema *s, RfEdit fn, void *ctx) {
+    int fd_read = open(s->file, O_RDONLY);
+    if (fd_read == -1) return errno == ENOENT ? 0 : -1;
+
+    static __thread RfOut out;                   // 64 KB buffers: kept off the stack
+    out.fd = open(s->tmp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out.fd == -1) {
+        close(fd_read);
+        return -1;
+    }
+    out.len = out.failed = 0;
+
+    static __thread LineReader lr;
+    Record r;
+    char *line;
+    size_t len;
+    int edits = 0;
+    line_reader_init(&lr, fd_read, 0, -1);
+    while ((line = line_reader_next(&lr, &len)) != NULL) {
+        int action = rf_parse(s, line, len, &r) == 0 ? fn(&r, ctx) : RF_KEEP;
+        if (action == RF_KEEP) {
+            rf_out_put(&out, line, len);
+            rf_out_put(&out, "\n", 1);
+        } else if (action == RF_CHANGED) {
+            char rec[RF_LINE_MAX];
+            int n = rf_format(&r, rec, sizeof(rec));
+            if (n == -1) out.failed = 1;
+            else rf_out_put(&out, rec, n);
+            edits++;
+        } else {
+            edits++;
+        }
+    }
+    rf_out_flush(&out);
+    close(fd_read);
+    close(out.fd);
+
+    if (out.failed || (edits > 0 && rename(s->tmp_file, s->file) != 0)) {
+        unlink(s->tmp_file);
+        return -1;
+    }
+    if (edits == 0) {
+        unlink(s->tmp_file);
+        return 0;
+    }
+    userdir_invalidate(s->file);
+    return edits;
+}
+
+/* ---- Shared edits ---- */
+
+typedef struct {
+    const char *username;
+    const char *old_pass;            // NULL: not checked
+    const char *new_pass;
+    int user_seen;
+} RfPasswordEdit;
+
+static int rf_password_edit(Record *r, void *ctx) {
+    RfPasswordEdit *e = ctx;
+    if (!rf_eq(r, USER_NAME, e->username)) return RF_KEEP;
+    e->user_seen = 1;
+    if (e->old_pass && !rf_eq(r, USER_PASS, e->old_pass)) return RF_KEEP;
+    rf_set_str(r, USER_PASS, e->new_pass);
+    return RF_CHANGED;
+}
+
+/* ------------------------------------------------------------
+   Change a user's password in a role file, checking the old one
+   unless old_pass is NULL. Caller holds sem_userdb.
+   Returns records changed (0: no such user or wrong password),
+   -1 on error; *user_seen (optional) tells the two 0 cases apart.
+   ------------------------------------------------------------ */
+static int rf_change_password(const RecSchema *s, const char *username, const char *old_pass,
+                              const char *new_pass, int *user_seen) {
+    RfPasswordEdit e = { username, old_pass, new_pass, 0 };
+    int n = rf_update(s, rf_password_edit, &e);
+    if (user_seen) *user_seen = e.user_seen;
+    return n;
+}
+
+typedef struct {
+    const char *username;
+    const char *password;
+    int active;
+} RfDetailsEdit;
+
+static int rf_details_edit(Record *r, void *ctx) {
+    RfDetailsEdit *e = ctx;
+    if (!rf_eq(r, USER_NAME, e->username)) return RF_KEEP;
+    rf_set_str(r, USER_PASS, e->password);
+    rf_set_int(r, USER_ACTIVE, e->active);
+    return RF_CHANGED;
+}
+
+/* Set a user's password and active flag. Caller holds sem_userdb.
+   Returns records changed (0: no such user), -1 on error. */
+static int rf_set_user_details(const RecSchema *s, const char *username, const char *password,
+                               int active) {
+    RfDetailsEdit e = { username, password, active };
+    return rf_update(s, rf_details_edit, &e);
+}
@@ -17,6 +17,9 @@
 // // #include <sys/wait.h>
 // // #include <semaphore.h>
 // // #include <fcntl.h>   // for O_CREAT in sem_open
+#define _GNU_SOURCE     // accept4, F_OFD_SETLKW, MAP_STACK
+#include <dirent.h>
+#include <time.h>
 
 // // #define PORT 9090
 // // #define BACKLOG 10
@@ -190,10 +193,19 @@
 
 #include "utils.h"
 #include "Struct.h"
+#include "account_store.c"
+#include "ledger.c"
+#include "wal.c"
+#include "user_dir.c"
+#include "session.c"
+#include "id_alloc.c"
+#include "record_file.c"
+#include "reactor.c"
 #include "admin_ops.c"
 #include "manager_ops.c"
 #include "customer_ops.c"
 #include "employee_ops.c"
+#include "command_api.c"
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
@@ -209,51 +221,144 @@
 #include <fcntl.h>   // for O_CREAT in sem_open
 
 #define PORT 9090
-#define BACKLOG 10
+#define BACKLOG SOMAXCONN
+#define PREFORK_WORKERS   8          // --prefork defaults
+#define PREFORK_SESSIONS  1000       // sessions a worker serves before it is recycled
 #define BUFSZ 256
 
 /* ------------------------------------------------------------
    Global named semaphores for system-wide coordination
    ------------------------------------------------------------ */
 sem_t *sem_userdb;   // protects user DBs (login files)
-sem_t *sem_account;  // protects account_db.txt
+sem_t *sem_account;  // serializes adding accounts (balances use record locks)
 sem_t *sem_loan;     // ✅ protects loan_db.txt
+sem_t *sem_ledger;   // guards the txlog/ segments and index.heads/index.links
+sem_t *sem_ledger_pack;  // wakes the ledger packer process
 /* ------------------------------------------------------------
    Helper: ensure required data files and directories exist
    ------------------------------------------------------------ */
 static void ensure_files_exist() {
     const char *files[] = {
         "admin.txt", "manager.txt", "employee.txt", "customer.txt",
-        "loan_db.txt", "account_db.txt", "feedback_db.txt"
+        "loan_db.txt", "feedback_db.txt"
     };
-    for (int i = 0; i < 7; i++) {
+    for (int i = 0; i < 6; i++) {
         int fd = open(files[i], O_CREAT | O_RDWR, 0644);
         if (fd == -1) perror("open create");
         close(fd);
     }
     mkdir("accounts", 0755); // optional future directory
+
+    // Binary account store: convert legacy account_db.txt once
+    account_store_migrate();
+}
+
+/* ------------------------------------------------------------
+   Helper: remove temp_*.txt files left by rewrites that were
+   interrupted before their rename (the original is still intact)
+   ------------------------------------------------------------ */
+static int remove_stray_temp_files() {
+    DIR *dir = opendir(".");
+    if (!dir) return 0;
+
+    int removed = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        size_t len = strlen(de->d_name);
+        int is_temp_txt = strncmp(de->d_name, "temp", 4) == 0 &&
+                          len > 4 && strcmp(de->d_name + len - 4, ".txt") == 0;
+        if (is_temp_txt || strcmp(de->d_name, ACCOUNT_DB_FILE ".tmp") == 0 ||
+            strcmp(de->d_name, WAL_TMP_FILE) == 0 || strcmp(de->d_name, ID_TRACKER_TMP) == 0) {
+            if (unlink(de->d_name) == 0) removed++;
+        }
+    }
+    closedir(dir);
+    return removed;
+}
+
+/* ------------------------------------------------------------
+   Crash recovery: runs before the accept loop, so no session
+   can observe a half-applied operation
+   ------------------------------------------------------------ */
+static void recover_after_crash() {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    int removed = remove_stray_temp_files();
+    int restored = 0;
+    int replayed = wal_recover(&restored);
+    if (replayed < 0) {
+        fprintf(stderr, "Crash recovery failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+    printf("Recovery: replayed %d log records, restored %d ledger rows, "
+           "removed %d temp files in %.2f ms\n", replayed, restored, removed, ms);
+    fflush(stdout);
 }
 
 /* ------------------------------------------------------------
-   SIGCHLD handler to reap zombie children
+   SIGCHLD handler to reap zombie children.
+   Their pids are queued for the accept loop, which releases any
+   session they still held (sem_wait is not safe in a handler).
    ------------------------------------------------------------ */
+#define REAP_QUEUE 1024
+static pid_t reaped[REAP_QUEUE];
+static volatile sig_atomic_t reaped_head = 0, reaped_tail = 0;
+
 static void reap_children(int sig) {
     (void)sig;
-    while (waitpid(-1, NULL, WNOHANG) > 0);
+    int saved_errno = errno;
+    pid_t pid;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        int next = (reaped_tail + 1) % REAP_QUEUE;
+        if (next == reaped_head) continue;  // full: session_begin() sweeps dead pids
+        reaped[reaped_tail] = pid;
+        reaped_tail = next;
+    }
+    errno = saved_errno;
+}
+
+/* 'exited' (optional) is told about every reaped pid */
+static void release_reaped_sessions(void (*exited)(pid_t pid)) {
+    while (reaped_head != reaped_tail) {
+        pid_t pid = reaped[reaped_head];
+        sem_wait(sem_userdb);
+        session_reap(pid);
+        sem_post(sem_userdb);
+        reaped_head = (reaped_head + 1) % REAP_QUEUE;
+        if (ledger_packer_reaped(pid)) continue;
+        if (exited) exited(pid);
+    }
+}
+
+/* reactor_run() callback: the epoll thread was interrupted by a signal */
+static void reactor_reap(void) {
+    release_reaped_sessions(NULL);
 }
 
 /* ------------------------------------------------------------
-   Handle one client connection (child process)
+   Serve one client connection until it disconnects
+   (a forked child, or a reactor session)
    ------------------------------------------------------------ */
-static void handle_client(int connfd) {
+static void serve_client(int connfd) {
     char role[BUFSZ], username[BUFSZ], password[BUFSZ];
     char filename[64];
+    int role_id;
     int valid;
 
+    message_conn_open(connfd);
+    message_set_buffered(connfd, 1);     // one write per reply, however many rows
     while (1) {
         send_message(connfd, "\nEnter role (admin/manager/employee/customer): ");
         if (receive_message(connfd, role, sizeof(role)) <= 0)
             break;
+        if (command_is_api(role)) {             // one-shot commands, no menus
+            command_session(connfd, role);
+            return;
+        }
         trim_newline(role);
 
         send_message(connfd, "Enter username: ");
@@ -267,10 +372,10 @@ static void handle_client(int connfd) {
         trim_newline(password);
 
         /* Select correct file based on role */
-        if      (strcmp(role, "admin")    == 0) strcpy(filename, "admin.txt");
-        else if (strcmp(role, "manager")  == 0) strcpy(filename, "manager.txt");
-        else if (strcmp(role, "employee") == 0) strcpy(filename, "employee.txt");
-        else if (strcmp(role, "customer") == 0) strcpy(filename, "customer.txt");
+        if      (strcmp(role, "admin")    == 0) { strcpy(filename, "admin.txt");    role_id = ROLE_ADMIN; }
+        else if (strcmp(role, "manager")  == 0) { strcpy(filename, "manager.txt");  role_id = ROLE_MANAGER; }
+        else if (strcmp(role, "employee") == 0) { strcpy(filename, "employee.txt"); role_id = ROLE_EMPLOYEE; }
+        else if (strcmp(role, "customer") == 0) { strcpy(filename, "customer.txt"); role_id = ROLE_CUSTOMER; }
         else {
             send_message(connfd, "Invalid role.\n");
             continue;
@@ -278,7 +383,12 @@ static void handle_client(int connfd) {
 
         /* ---------- Semaphore region ---------- */
         sem_wait(sem_userdb);
-        valid = validate_login(filename, username, password);
+        valid = userdir_authenticate(filename, username, password);
+        if (valid == 1) {
+            int slot = session_begin(role_id, username);
+            if (slot == SESSION_TAKEN) valid = -2;
+            else if (slot == SESSION_FULL) valid = -3;
+        }
         sem_post(sem_userdb);
         /* -------------------------------------- */
 
@@ -296,9 +406,9 @@ static void handle_client(int connfd) {
             else
                 send_message(connfd, "No operations implemented for this role yet.\n");
 
-            // LOGOUT STEP: Mark user as logged out in the file after menu returns
+            // LOGOUT STEP: end the session after menu returns
             sem_wait(sem_userdb);
-            mark_user_logged_out(filename, username); // CALL THE NEW FUNCTION
+            session_end();
             sem_post(sem_userdb);
             
             // after logout (return from menu), continue loop to re-login
@@ -308,56 +418,262 @@ static void handle_client(int connfd) {
             send_message(connfd, "This user is already logged in from another session.\n");
         } else if (valid == 0) { // 0 is now INVALID CREDENTIALS or INACTIVE
             send_message(connfd, "Invalid username or password (or account is inactive).\n");
+        } else if (valid == -3) {
+            send_message(connfd, "Server busy: too many sessions, try again later.\n");
         }
     }
 
     send_message(connfd, "Disconnected from server.\n");
+    message_flush(connfd);
+}
+
+/* ------------------------------------------------------------
+   Handle one client connection (child process)
+   ------------------------------------------------------------ */
+static void handle_client(int connfd) {
+    serve_client(connfd);
+    close(connfd);
+    _exit(0);
+}
+
+/* ------------------------------------------------------------
+   Listening socket on PORT. With 'reuseport' several sockets can
+   bind the port and the kernel spreads connections across them.
+   ------------------------------------------------------------ */
+static int open_listener(int reuseport) {
+    struct sockaddr_in servaddr;
+    int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenfd < 0) return -1;
+
+    int opt = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        close(listenfd);
+        return -1;
+    }
+
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servaddr.sin_port = htons(PORT);
+
+    if (bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0 ||
+        listen(listenfd, BACKLOG) < 0) {
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+/* ------------------------------------------------------------
+   Prefork mode: long-lived workers, each serving one client at a
+   time, so a new connection costs an accept() instead of a fork().
+
+   The parent opens one SO_REUSEPORT listener per worker, so the
+   kernel spreads connections over that many accept queues, and
+   keeps them open. Every worker waits on all of them through its
+   own epoll set (EPOLLEXCLUSIVE: one idle worker is woken per
+   connection), so a connection hashed to a busy worker's queue is
+   taken by an idle one, and a worker can exit without dropping
+   what is queued. A worker exits after max_sessions clients
+   (0 = never); the parent only supervises and replaces every
+   worker that exits or dies.
+   ------------------------------------------------------------ */
+static int *prefork_listeners = NULL;
+static pid_t *prefork_pids = NULL;
+static time_t *prefork_started = NULL;
+static int prefork_nworkers = 0;
+static int prefork_max_sessions = 0;
+static sigset_t prefork_mask;        // signal mask for new workers
+
+/* Serve one client; menu "Exit" jumps back here instead of exiting */
+static void prefork_serve(int connfd) {
+    static sigjmp_buf session_end_jmp;
+    if (sigsetjmp(session_end_jmp, 1) == 0) {
+        client_exit_jmp = &session_end_jmp;
+        serve_client(connfd);
+    }
+    client_exit_jmp = NULL;
     close(connfd);
+}
+
+static void prefork_worker(void) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        _exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < prefork_nworkers; i++) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.fd = prefork_listeners[i];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, prefork_listeners[i], &ev) == -1) {
+            perror("epoll_ctl listen");
+            _exit(EXIT_FAILURE);
+        }
+    }
+
+    int served = 0;
+    while (prefork_max_sessions == 0 || served < prefork_max_sessions) {
+        struct epoll_event ev;
+        if (epoll_wait(epfd, &ev, 1, -1) != 1) continue;
+
+        // Another worker may have won the race for it (EAGAIN)
+        int connfd = accept(ev.data.fd, NULL, NULL);
+        if (connfd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("accept");
+            continue;
+        }
+        prefork_serve(connfd);
+        served++;
+    }
     _exit(0);
 }
 
+static void prefork_spawn(int i) {
+    // A slot whose worker keeps dying right away restarts at most
+    // once a second; the new worker waits, not the parent
+    int throttle = prefork_started[i] && time(NULL) - prefork_started[i] < 1;
+    prefork_started[i] = time(NULL);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        sigprocmask(SIG_SETMASK, &prefork_mask, NULL);
+        if (throttle) sleep(1);
+        prefork_worker();
+    }
+    if (pid < 0) perror("fork");
+    prefork_pids[i] = pid;
+}
+
+/* release_reaped_sessions() callback: replace a worker that exited */
+static void prefork_replace(pid_t pid) {
+    for (int i = 0; i < prefork_nworkers; i++)
+        if (prefork_pids[i] == pid) prefork_spawn(i);
+}
+
+static void prefork_run(int nworkers, int max_sessions) {
+    prefork_nworkers = nworkers > 0 ? nworkers : PREFORK_WORKERS;
+    prefork_max_sessions = max_sessions >= 0 ? max_sessions : PREFORK_SESSIONS;
+    prefork_listeners = calloc(prefork_nworkers, sizeof(int));
+    prefork_pids = calloc(prefork_nworkers, sizeof(pid_t));
+    prefork_started = calloc(prefork_nworkers, sizeof(time_t));
+    if (!prefork_listeners || !prefork_pids || !prefork_started) error_exit("calloc");
+
+    for (int i = 0; i < prefork_nworkers; i++) {
+        prefork_listeners[i] = open_listener(1);
+        if (prefork_listeners[i] < 0) error_exit("listen");
+        fcntl(prefork_listeners[i], F_SETFL, O_NONBLOCK);
+    }
+    printf("Server listening on port %d...\n", PORT);
+
+    // SIGCHLD stays blocked outside sigsuspend(), so a worker exit
+    // cannot slip in between the reap queue check and the wait
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &prefork_mask);
+
+    for (int i = 0; i < prefork_nworkers; i++) prefork_spawn(i);
+    printf("Prefork: %d workers, %d sessions each\n", prefork_nworkers, prefork_max_sessions);
+    fflush(stdout);
+
+    while (1) {
+        release_reaped_sessions(prefork_replace);
+        for (int i = 0; i < prefork_nworkers; i++)
+            if (prefork_pids[i] < 0) prefork_spawn(i);   // fork failed earlier
+        sigsuspend(&prefork_mask);
+    }
+}
+
 /* ------------------------------------------------------------
    Main server setup
+   Usage: server                                 process per connection
+          server --reactor [workers]             epoll loop + worker threads
+          server --prefork [workers [sessions]]  pre-forked, recycled workers
    ------------------------------------------------------------ */
-int main() {
+int main(int argc, char **argv) {
     int listenfd, connfd;
-    struct sockaddr_in servaddr, cliaddr;
+    int reactor_mode = argc > 1 && strcmp(argv[1], "--reactor") == 0;
+    int prefork_mode = argc > 1 && strcmp(argv[1], "--prefork") == 0;
+    int nworkers = argc > 2 ? atoi(argv[2]) : 0;
+    int max_sessions = argc > 3 ? atoi(argv[3]) : -1;
+    struct sockaddr_in cliaddr;
     socklen_t clilen = sizeof(cliaddr);
 
-    signal(SIGCHLD, reap_children);
+    // No SA_RESTART: accept() returns EINTR so reaped sessions are released promptly
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = reap_children;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
     ensure_files_exist();
 
     /* ---------- Semaphore initialization ---------- */
     sem_userdb = sem_open("/sem_userdb", O_CREAT, 0644, 1);
     sem_account = sem_open("/sem_account", O_CREAT, 0644, 1);
     sem_loan = sem_open("/sem_loan", O_CREAT, 0644, 1);   // ✅ new
+    sem_ledger = sem_open("/sem_ledger", O_CREAT, 0644, 1);
+    sem_ledger_pack = sem_open("/sem_ledger_pack", O_CREAT, 0644, 0);
 
-    if (sem_userdb == SEM_FAILED || sem_account == SEM_FAILED || sem_loan == SEM_FAILED) {
+    if (sem_userdb == SEM_FAILED || sem_account == SEM_FAILED || sem_loan == SEM_FAILED ||
+        sem_ledger == SEM_FAILED || sem_ledger_pack == SEM_FAILED) {
         perror("sem_open");
         exit(EXIT_FAILURE);
     }
     /* ------------------------------------------------ */
 
-    listenfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listenfd < 0) error_exit("socket");
+    /* ---------- Shared account table (inherited by every child) ---------- */
+    int naccounts = account_table_load();
+    if (naccounts < 0) {
+        fprintf(stderr, "Failed to load account table\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("Loaded %d accounts into shared memory\n", naccounts);
 
-    int opt = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (userdir_init() == -1) {
+        fprintf(stderr, "Failed to load user directory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (session_init() == -1) {
+        fprintf(stderr, "Failed to create session registry\n");
+        exit(EXIT_FAILURE);
+    }
+    if (id_alloc_init() == -1) {
+        fprintf(stderr, "Failed to initialise ID allocator\n");
+        exit(EXIT_FAILURE);
+    }
 
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    servaddr.sin_port = htons(PORT);
+    if (ledger_open() == -1) {
+        fprintf(stderr, "Failed to open transaction ledger\n");
+        exit(EXIT_FAILURE);
+    }
 
-    if (bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0)
-        error_exit("bind");
+    recover_after_crash();
 
-    if (listen(listenfd, BACKLOG) < 0)
-        error_exit("listen");
+    if (wal_init() == -1) {
+        fprintf(stderr, "Failed to open write-ahead log\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (ledger_packer_start() == -1)
+        perror("ledger packer");         // sessions pack cold segments themselves
+
+    if (prefork_mode) prefork_run(nworkers, max_sessions);
+
+    listenfd = open_listener(0);
+    if (listenfd < 0) error_exit("listen");
 
     printf("Server listening on port %d...\n", PORT);
 
+    if (reactor_mode) {
+        reactor_run(listenfd, nworkers, serve_client, reactor_reap);
+        exit(EXIT_FAILURE);
+    }
+
     while (1) {
+        release_reaped_sessions(NULL);
         connfd = accept(listenfd, (struct sockaddr *)&cliaddr, &clilen);
         if (connfd < 0) {
             if (errno == EINTR) continue;
@@ -382,9 +698,13 @@ int main() {
     sem_close(sem_userdb);
     sem_close(sem_account);
     sem_close(sem_loan);          // ✅ new
+    sem_close(sem_ledger);
+    sem_close(sem_ledger_pack);
     sem_unlink("/sem_userdb");
     sem_unlink("/sem_account");
     sem_unlink("/sem_loan");      // ✅ new
+    sem_unlink("/sem_ledger");
+    sem_unlink("/sem_ledger_pack");
     return 0;
 }
 
@@ -0,0 +1,263 @@
+/* session.c
+   Shared-memory session registry: one slot per live login.
+
+   Replaces the logged_in column of the role files as the record of
+   who is logged in. A slot holds the session's pid, role, username,
+   login time and last activity; slots are found by (role, username)
+   through a chained hash and recycled through a free list, so
+   starting and ending a session are O(1).
+
+   The registry lives in anonymous shared memory, so a server restart
+   starts with no sessions, and a child that dies without logging out
+   is released by the parent: reap_children() queues the pid and
+   session_reap() frees whatever slot that pid still held.
+
+   The command API (command_api.c) logs in without a menu: its
+   sessions belong to no process (pid SESSION_API) and are named by a
+   token handed to the client; they end on LOGOUT or after
+   SESSION_API_IDLE seconds without a command.
+   Callers hold sem_userdb around every function except
+   session_touch().
+   Designed to be included directly into server.c (no header).
+*/
+
+#include "utils.h"
+#include "Struct.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+
+#define SESSION_CAP      4096            // concurrent logins
+#define SESSION_BUCKETS  8192            // power of two
+#define SESSION_PID_MAX_FILE "/proc/sys/kernel/pid_max"
+#define SESSION_API      -1              // pid of a token session
+#define SESSION_API_IDLE 900             // seconds a token stays valid unused
+#define SESSION_SECRET   32              // hex digits of a token's secret
+
+#define SESSION_TAKEN  -2                // user already has a live session
+#define SESSION_FULL   -1                // no free slot
+
+typedef struct {
+    pid_t pid;                       // owning child, SESSION_API, 0 = free
+    int role;                        // UserRole
+    char username[64];
+    char secret[SESSION_SECRET + 1]; // token sessions only
+    time_t login_time;
+    time_t last_active;
+    int next;                        // hash chain, or free list while free (-1 = end)
+} Session;
+
+typedef struct {
+    int free_head;
+    int count;                       // live sessions
+    int bucket[SESSION_BUCKETS];     // head of each chain, -1 = empty
+    Session slot[SESSION_CAP];
+} SessionRegistry;
+
+static SessionRegistry *sessions = NULL;  // mapped by the parent, inherited by children
+static int *session_of_pid = NULL;        // pid -> slot + 1, 0 = none
+static int session_pid_max = 0;
+static __thread int current_session = -1; // this session's slot, if logged in
+                                          // (the reactor swaps it per session)
+
+static uint32_t session_hash(int role, const char *username) {
+    uint32_t h = 2166136261u ^ (uint32_t)role;
+    for (const unsigned char *p = (const unsigned char *)username; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h & (SESSION_BUCKETS - 1);
+}
+
+/* ------------------------------------------------------------
+   Map the registry and the pid -> slot map.
+   Must run in the parent before the first fork().
+   ------------------------------------------------------------ */
+int session_init(void) {
+    session_pid_max = 1 << 22;           // kernel upper bound on 64-bit
+    FILE *f = fopen(SESSION_PID_MAX_FILE, "r");
+    if (f) {
+        int v;
+        if (fscanf(f, "%d", &v) == 1 && v > 0) session_pid_max = v;
+        fclose(f);
+    }
+
+    sessions = mmap(NULL, sizeof(SessionRegistry), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    session_of_pid = mmap(NULL, (size_t)(session_pid_max + 1) * sizeof(int),
+                          PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sessions == MAP_FAILED || session_of_pid == MAP_FAILED) {
+        perror("mmap session registry");
+        return -1;
+    }
+
+    for (int b = 0; b < SESSION_BUCKETS; b++)
+        sessions->bucket[b] = -1;
+    for (int i = 0; i < SESSION_CAP; i++)
+        sessions->slot[i].next = (i + 1 < SESSION_CAP) ? i + 1 : -1;
+    sessions->free_head = 0;
+    sessions->count = 0;
+    return 0;
+}
+
+static int session_find(int role, const char *username) {
+    for (int i = sessions->bucket[session_hash(role, username)]; i != -1; i = sessions->slot[i].next)
+        if (sessions->slot[i].role == role && strcmp(sessions->slot[i].username, username) == 0)
+            return i;
+    return -1;
+}
+
+static void session_release(int i) {
+    Session *s = &sessions->slot[i];
+    int *link = &sessions->bucket[session_hash(s->role, s->username)];
+    while (*link != i)
+        link = &sessions->slot[*link].next;
+    *link = s->next;
+
+    if (s->pid > 0 && s->pid <= session_pid_max && session_of_pid[s->pid] == i + 1)
+        session_of_pid[s->pid] = 0;
+    s->pid = 0;
+    s->next = sessions->free_head;
+    sessions->free_head = i;
+    sessions->count--;
+}
+
+/* A live slot whose owner is gone: a dead process, or a token
+   left unused for too long */
+static int session_stale(int i) {
+    Session *s = &sessions->slot[i];
+    if (s->pid == SESSION_API)
+        return time(NULL) - s->last_active > SESSION_API_IDLE;
+    return s->pid > 0 && kill(s->pid, 0) == -1 && errno == ESRCH;
+}
+
+/* Free stale slots; a safety net for pids that never made it
+   through the reap queue, and where expired tokens go */
+static void session_sweep(void) {
+    for (int i = 0; i < SESSION_CAP; i++)
+        if (sessions->slot[i].pid != 0 && session_stale(i))
+            session_release(i);
+}
+
+/* Take a free slot for (role, username), owned by 'pid' */
+static int session_alloc(int role, const char *username, pid_t pid) {
+    int i = session_find(role, username);
+    if (i >= 0) {
+        if (!session_stale(i))
+            return SESSION_TAKEN;
+        session_release(i);         // owner died and was not reaped yet
+    }
+
+    if (sessions->free_head == -1) session_sweep();
+    if (sessions->free_head == -1) return SESSION_FULL;
+
+    i = sessions->free_head;
+    Session *s = &sessions->slot[i];
+    sessions->free_head = s->next;
+
+    s->pid = pid;
+    s->role = role;
+    strncpy(s->username, username, sizeof(s->username) - 1);
+    s->username[sizeof(s->username) - 1] = '\0';
+    s->login_time = s->last_active = time(NULL);
+
+    int b = session_hash(role, s->username);
+    s->next = sessions->bucket[b];
+    sessions->bucket[b] = i;
+    sessions->count++;
+
+    return i;
+}
+
+/* ------------------------------------------------------------
+   Register a login for the calling process.
+   Returns the slot, SESSION_TAKEN or SESSION_FULL.
+   ------------------------------------------------------------ */
+int session_begin(int role, const char *username) {
+    pid_t pid = getpid();
+    int i = session_alloc(role, username, pid);
+    if (i < 0) return i;
+
+    if (pid <= session_pid_max) session_of_pid[pid] = i + 1;
+    current_session = i;
+    return i;
+}
+
+/* ------------------------------------------------------------
+   Token login for the command API. A user who already holds a
+   live token gets the same one back; any other live session
+   makes it SESSION_TAKEN. On success the token ("<slot>-<secret>")
+   is written to 'token' and the slot is returned.
+   ------------------------------------------------------------ */
+int session_api_begin(int role, const char *username, char *token, size_t cap) {
+    int i = session_find(role, username);
+    if (i < 0 || sessions->slot[i].pid != SESSION_API || session_stale(i)) {
+        unsigned char raw[SESSION_SECRET / 2];
+        if (getrandom(raw, sizeof(raw), 0) != (ssize_t)sizeof(raw)) return SESSION_FULL;
+
+        i = session_alloc(role, username, SESSION_API);
+        if (i < 0) return i;
+        for (size_t k = 0; k < sizeof(raw); k++)
+            snprintf(sessions->slot[i].secret + 2 * k, 3, "%02x", raw[k]);
+    }
+    sessions->slot[i].last_active = time(NULL);
+    snprintf(token, cap, "%d-%s", i, sessions->slot[i].secret);
+    return i;
+}
+
+/* ------------------------------------------------------------
+   Resolve a token to its live session and mark it used.
+   Returns the slot (role and username filled in) or -1.
+   ------------------------------------------------------------ */
+int session_api_find(const char *token, int *role, char *username, size_t cap) {
+    char *dash;
+    long i = strtol(token, &dash, 10);
+    if (dash == token || *dash != '-' || i < 0 || i >= SESSION_CAP) return -1;
+
+    Session *s = &sessions->slot[i];
+    if (s->pid != SESSION_API || session_stale(i) || strlen(dash + 1) != SESSION_SECRET)
+        return -1;
+
+    // Compare all of it, so timing does not tell how much matched
+    unsigned char diff = 0;
+    for (int k = 0; k < SESSION_SECRET; k++)
+        diff |= (unsigned char)(s->secret[k] ^ dash[1 + k]);
+    if (diff) return -1;
+
+    s->last_active = time(NULL);
+    *role = s->role;
+    snprintf(username, cap, "%s", s->username);
+    return i;
+}
+
+/* End a token session (LOGOUT) */
+void session_api_end(int slot) {
+    if (slot >= 0 && slot < SESSION_CAP && sessions->slot[slot].pid == SESSION_API)
+        session_release(slot);
+}
+
+/* End the calling process's session (logout / exit) */
+void session_end(void) {
+    if (current_session >= 0 && sessions->slot[current_session].pid == getpid())
+        session_release(current_session);
+    current_session = -1;
+}
+
+/* Record activity on the current session; a single store, no lock */
+void session_touch(void) {
+    if (current_session >= 0)
+        sessions->slot[current_session].last_active = time(NULL);
+}
+
+/* Parent: release the session of a child that has exited */
+void session_reap(pid_t pid) {
+    if (pid <= 0 || pid > session_pid_max) return;
+    int v = session_of_pid[pid];
+    if (v > 0 && sessions->slot[v - 1].pid == pid)
+        session_release(v - 1);
+}
@@ -0,0 +1,247 @@
+/* user_dir.c
+   Shared in-memory user directory for the role files
+   (admin.txt, manager.txt, employee.txt, customer.txt).
+
+   Each role file gets a MAP_SHARED hash table (username -> entry)
+   built by the parent before the accept loop, so authentication is
+   an O(1) lookup instead of a scan of the whole file. Who is logged
+   in is tracked by the session registry (session.c), not here.
+
+   The text file stays the source of truth:
+   - lines appended to the file (add_user, new customers) are picked
+     up by parsing only the new tail;
+   - code that rewrites a role file through rename() calls
+     userdir_invalidate(), and the next lookup reloads it.
+   Every function expects the caller to hold sem_userdb, the lock that
+   already serializes all writers of these files.
+   Designed to be included directly into server.c (no header).
+*/
+
+#include "utils.h"
+#include "Struct.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define USERDIR_ROLES        4
+#define USERDIR_CAP_STAFF    (1 << 12)       // admins, managers, employees
+#define USERDIR_CAP_CUSTOMER (1 << 18)
+
+typedef struct {
+    int id;
+    int active;
+    char username[64];
+    char password[64];
+} UserEntry;
+
+typedef struct {
+    char filename[32];
+    int stale;                       // set by userdir_invalidate(): reload before use
+    dev_t dev;                       // identity and length of the file as parsed
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    int count;
+    int capacity;
+    uint32_t nbuckets;               // power of two, >= 2 * capacity
+} UserDirHeader;
+
+typedef struct {
+    UserDirHeader *hdr;              // everything below lives in one shared mapping
+    UserEntry *entry;
+    int32_t *bucket;                 // entry index + 1, 0 = empty
+} UserDir;
+
+static UserDir user_dirs[USERDIR_ROLES];   // mapped by the parent, inherited by children
+
+static const char *userdir_files[USERDIR_ROLES] = {
+    "admin.txt", "manager.txt", "employee.txt", "customer.txt"
+};
+
+/* FNV-1a over the username */
+static uint32_t userdir_hash(const char *username) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)username; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static UserDir *userdir_for(const char *filename) {
+    for (int i = 0; i < USERDIR_ROLES; i++)
+        if (user_dirs[i].hdr && strcmp(user_dirs[i].hdr->filename, filename) == 0)
+            return &user_dirs[i];
+    return NULL;
+}
+
+static int userdir_find(UserDir *d, const char *username) {
+    uint32_t mask = d->hdr->nbuckets - 1;
+    uint32_t b = userdir_hash(username) & mask;
+    int32_t v;
+
+    while ((v = d->bucket[b]) != 0) {
+        if (strcmp(d->entry[v - 1].username, username) == 0)
+            return v - 1;
+        b = (b + 1) & mask;
+    }
+    return -1;
+}
+
+/* Add one "<id> <username> <password> <active> <logged_in>" line.
+   Other lines cannot log in, as before; the last column is no
+   longer consulted. */
+static void userdir_add_line(UserDir *d, const char *line) {
+    UserEntry e;
+    RecField f[5];
+    int logged_in;
+    memset(&e, 0, sizeof(e));
+    if (rec_split(line, strlen(line), f, 5) != 5 || rec_int(f[0], &e.id) == -1 ||
+        rec_int(f[3], &e.active) == -1 || rec_int(f[4], &logged_in) == -1)
+        return;
+    rec_copy(f[1], e.username, sizeof(e.username));
+    rec_copy(f[2], e.password, sizeof(e.password));
+
+    // First line for a name wins; later duplicates stay unreachable
+    uint32_t mask = d->hdr->nbuckets - 1;
+    uint32_t b = userdir_hash(e.username) & mask;
+    while (d->bucket[b] != 0) {
+        if (strcmp(d->entry[d->bucket[b] - 1].username, e.username) == 0)
+            return;
+        b = (b + 1) & mask;
+    }
+
+    if (d->hdr->count >= d->hdr->capacity) {
+        fprintf(stderr, "%s: user directory full, '%s' not loaded\n",
+                d->hdr->filename, e.username);
+        return;
+    }
+    d->entry[d->hdr->count] = e;
+    d->bucket[b] = ++d->hdr->count;
+}
+
+/* Parse complete lines from 'from' to the end of the file */
+static int userdir_parse(UserDir *d, off_t from) {
+    int fd = open(d->hdr->filename, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    char buf[4096], line[512];
+    off_t off = from, line_end = from;
+    int pos = 0;
+    ssize_t r;
+
+    while ((r = pread(fd, buf, sizeof(buf), off)) > 0) {
+        for (ssize_t i = 0; i < r; i++) {
+            if (buf[i] == '\n') {
+                line[pos] = '\0';
+                if (pos > 0) userdir_add_line(d, line);
+                pos = 0;
+                line_end = off + i + 1;
+            } else if (pos < (int)sizeof(line) - 1) {
+                line[pos++] = buf[i];
+            }
+        }
+        off += r;
+    }
+    close(fd);
+
+    // A line still missing its '\n' is picked up by the next parse
+    d->hdr->dev = st.st_dev;
+    d->hdr->ino = st.st_ino;
+    d->hdr->size = line_end;
+    d->hdr->mtime = st.st_mtim;
+    return 0;
+}
+
+static int userdir_reload(UserDir *d) {
+    memset(d->bucket, 0, (size_t)d->hdr->nbuckets * sizeof(int32_t));
+    d->hdr->count = 0;
+    d->hdr->stale = 0;
+    return userdir_parse(d, 0);
+}
+
+/* ------------------------------------------------------------
+   Bring the directory up to date with its file: nothing to do if
+   the file is unchanged, parse only the tail if lines were
+   appended, reload fully if it was rewritten.
+   ------------------------------------------------------------ */
+static int userdir_sync(UserDir *d) {
+    struct stat st;
+    if (stat(d->hdr->filename, &st) == -1) return -1;
+
+    UserDirHeader *h = d->hdr;
+    if (h->stale || st.st_dev != h->dev || st.st_ino != h->ino || st.st_size < h->size)
+        return userdir_reload(d);
+
+    if (st.st_size > h->size)
+        return userdir_parse(d, h->size);
+
+    if (st.st_mtim.tv_sec != h->mtime.tv_sec || st.st_mtim.tv_nsec != h->mtime.tv_nsec)
+        return userdir_reload(d);   // same length but edited in place by someone else
+    return 0;
+}
+
+/* ------------------------------------------------------------
+   Map one directory per role file and load them.
+   Must run in the parent before the first fork().
+   ------------------------------------------------------------ */
+int userdir_init(void) {
+    for (int i = 0; i < USERDIR_ROLES; i++) {
+        int cap = (i == USERDIR_ROLES - 1) ? USERDIR_CAP_CUSTOMER : USERDIR_CAP_STAFF;
+        uint32_t nbuckets = (uint32_t)cap * 2;
+        size_t bytes = sizeof(UserDirHeader) + (size_t)cap * sizeof(UserEntry) +
+                       (size_t)nbuckets * sizeof(int32_t);
+
+        void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            perror("mmap user directory");
+            return -1;
+        }
+
+        UserDir *d = &user_dirs[i];
+        d->hdr = base;
+        d->entry = (UserEntry *)(d->hdr + 1);
+        d->bucket = (int32_t *)(d->entry + cap);
+
+        strncpy(d->hdr->filename, userdir_files[i], sizeof(d->hdr->filename) - 1);
+        d->hdr->capacity = cap;
+        d->hdr->nbuckets = nbuckets;
+        if (userdir_reload(d) == -1) {
+            perror(userdir_files[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* A role file was replaced by rename(); reload on next use */
+void userdir_invalidate(const char *filename) {
+    UserDir *d = userdir_for(filename);
+    if (d) d->hdr->stale = 1;
+}
+
+/* ------------------------------------------------------------
+   Check credentials: 1 if the user exists with this password
+   and is active, 0 otherwise.
+   ------------------------------------------------------------ */
+int userdir_authenticate(const char *filename, const char *username, const char *password) {
+    UserDir *d = userdir_for(filename);
+    if (!d || userdir_sync(d) == -1) return 0;
+
+    int i = userdir_find(d, username);
+    if (i < 0) return 0;
+
+    UserEntry *e = &d->entry[i];
+    return strcmp(e->password, password) == 0 && e->active != 0;
+}
@@ -1,6 +1,17 @@
+#define _GNU_SOURCE                     // F_OFD_SETLKW
 #include "utils.h"
 #include<semaphore.h>
+#include <stdint.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define REC_SIMD                         // SSE2 always, AVX2 if the CPU has it
+#endif
 
 #ifdef SERVER_SIDE // <-- ADDED
 extern sem_t *sem_userdb;
@@ -36,417 +47,387 @@ int unlock_file(int fd) {
     return 0;
 }
 
-/* =========================================================
-   HELPER FUNCTION: Read one line from file descriptor
-   ========================================================= */
-ssize_t read_line(int fd, char *buf, size_t maxlen) {
-    ssize_t n, rc;
-    char c;
-    for (n = 0; n < (ssize_t)(maxlen - 1); n++) {
-        rc = read(fd, &c, 1);
-        if (rc == 1) {
-            buf[n] = c;
-            if (c == '\n') break;
-        } else if (rc == 0) {
-            break; // EOF
-        } else {
-            if (errno == EINTR) continue;
-            return -1;
-        }
+/* Byte-range variants: lock only [start, start + len) of the file */
+int lock_record(int fd, off_t start, off_t len, int lock_type) {
+    struct flock fl;
+    fl.l_type = lock_type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+
+    while (fcntl(fd, F_SETLKW, &fl) == -1) {
+        if (errno == EINTR) continue;
+        perror("Error locking record");
+        return -1;
+    }
+    return 0;
+}
+
+int unlock_record(int fd, off_t start, off_t len) {
+    struct flock fl;
+    fl.l_type = F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+
+    if (fcntl(fd, F_SETLK, &fl) == -1) {
+        perror("Error unlocking record");
+        return -1;
+    }
+    return 0;
+}
+
+int lock_record_ofd(int fd, off_t start, off_t len, int lock_type) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));              // l_pid must be 0
+    fl.l_type = lock_type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+
+    while (fcntl(fd, F_OFD_SETLKW, &fl) == -1) {
+        if (errno == EINTR) continue;
+        perror("Error locking record");
+        return -1;
+    }
+    return 0;
+}
+
+int unlock_record_ofd(int fd, off_t start, off_t len) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+
+    if (fcntl(fd, F_OFD_SETLK, &fl) == -1) {
+        perror("Error unlocking record");
+        return -1;
     }
-    buf[n] = '\0';
-    return n;
+    return 0;
 }
 
 /* =========================================================
-   AUTHENTICATION FUNCTION (open/read)
-   Checks username/password in text DB file.
-   Format: <id> <username> <password>
+   BUFFERED LINE READER
+   One pread() per LINE_READER_BUF bytes instead of one read()
+   per byte; lines are handed out in place, never copied.
    ========================================================= */
+void line_reader_init(LineReader *lr, int fd, off_t start, off_t end) {
+    lr->fd = fd;
+    lr->pos = start;
+    lr->end = end;
+    lr->start = lr->len = 0;
+}
 
-   /* ----------------------------------------------------------
-   check_existing_user()
-   Checks if a username already exists in the given file.
-   Returns 1 if found, 0 if not found, -1 on error.
-   ---------------------------------------------------------- */
-int check_existing_user(const char *filename, const char *username) {
-    int fd = open(filename, O_RDONLY);
-    if (fd == -1) {
-        // If file doesn't exist, no duplicates.
-        return 0;
+/* Move the unread bytes to the front and read more behind them.
+   Returns bytes read, 0 at the end, -1 on error. */
+static ssize_t line_reader_fill(LineReader *lr) {
+    if (lr->start > 0) {
+        memmove(lr->buf, lr->buf + lr->start, lr->len);
+        lr->start = 0;
     }
+    size_t room = LINE_READER_BUF - lr->len;
+    if (lr->end >= 0 && (off_t)room > lr->end - lr->pos) room = lr->end - lr->pos;
+    if (room == 0) return 0;
 
-    char buf[512], line[256];
     ssize_t r;
-    int pos = 0;
-
-    while ((r = read(fd, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < r; ++i) {
-            if (buf[i] == '\n' || pos >= (int)sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-                if (line[0] != '\0') {
-                    // parse the username token
-                    char copy[256];
-                    strncpy(copy, line, sizeof(copy) - 1);
-                    copy[sizeof(copy) - 1] = '\0';
-                    char *tok = strtok(copy, " "); // skip id
-                    tok = strtok(NULL, " ");       // username
-                    if (tok && strcmp(tok, username) == 0) {
-                        close(fd);
-                        return 1;  // found duplicate
-                    }
-                }
-            } else {
-                line[pos++] = buf[i];
-            }
-        }
+    while ((r = pread(lr->fd, lr->buf + lr->len, room, lr->pos)) == -1 && errno == EINTR)
+        ;
+    if (r > 0) {
+        lr->pos += r;
+        lr->len += r;
     }
-
-    close(fd);
-    return 0; // not found
+    return r;
 }
 
-// In utils.c, REPLACE existing validate_login(...)
+/* Next line (without its '\n'), or NULL at the end of the file.
+   *len, if given, gets the line's length. A last line with no '\n'
+   is returned too. */
+char *line_reader_next(LineReader *lr, size_t *len) {
+    size_t scanned = 0;
+    for (;;) {
+        char *p = lr->buf + lr->start;
+        char *nl = memchr(p + scanned, '\n', lr->len - scanned);
+        if (nl) {
+            size_t n = nl - p;
+            *nl = '\0';
+            lr->start += n + 1;
+            lr->len -= n + 1;
+            if (len) *len = n;
+            return p;
+        }
+        scanned = lr->len;
+        if ((lr->start == 0 && lr->len == LINE_READER_BUF) || line_reader_fill(lr) <= 0)
+            break;
+    }
+    if (lr->len == 0) return NULL;
+
+    // Unterminated last line, or a line that fills the whole buffer
+    char *p = lr->buf + lr->start;
+    size_t n = lr->len;
+    p[n] = '\0';                        // buf has a spare byte for this
+    lr->start += n;
+    lr->len = 0;
+    if (len) *len = n;
+    return p;
+}
 
-// Returns: 1 (Success), 0 (Failure: Invalid credentials or Inactive), -2 (Failure: Already logged in)
-int validate_login(const char *filename, const char *username, const char *password) {
-    char temp_file[] = "temp_login.txt";
-    int fd_read, fd_write;
-    char buffer[512], line[256];
-    ssize_t n, r;
-    int pos = 0;
-    int result = 0; // Default: Failure/Inactive
-    int found_match = 0;
+/* =========================================================
+   RECORD TOKENIZER
+   Separators are found a vector at a time: compare, take the
+   movemask, and walk its set bits. The AVX2 loop is compiled for
+   that target alone and picked at run time, so the default build
+   stays runnable on any x86-64; SSE2 is the baseline there. The
+   tail shorter than a vector (and every byte on other targets)
+   goes through the scalar loop.
+   ========================================================= */
+typedef struct {
+    int n;                           // fields found so far
+    size_t start;                    // where the current field began
+} RecSplit;
 
-    fd_read = open(filename, O_RDONLY);
-    if (fd_read < 0) {
-        // file open error or file doesn't exist.
-        return 0;
-    }
+static inline int rec_is_sep(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
 
-    fd_write = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_write < 0) {
-        close(fd_read);
-        return 0;
+/* Close the fields ending at the separators in mask m (bit i is
+   line[at + i]). Returns -1 once max fields are taken. */
+static inline __attribute__((always_inline))
+int rec_split_bits(const char *line, size_t at, uint32_t m, RecField *f, int max, RecSplit *st) {
+    while (m) {
+        size_t i = at + __builtin_ctz(m);
+        m &= m - 1;
+        if (i > st->start) {
+            if (st->n == max) return -1;
+            f[st->n].p = line + st->start;
+            f[st->n++].len = (int)(i - st->start);
+        }
+        st->start = i + 1;
     }
+    return 0;
+}
 
-    // Read and rewrite file, applying changes only to the matching user
-    while ((n = read(fd_read, buffer, sizeof(buffer))) > 0) {
-        for (ssize_t i = 0; i < n; i++) {
-            if (buffer[i] == '\n' || pos >= sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-                
-                if (line[0] != '\0') {
-                    int id, active, logged_in;
-                    char file_username[64], file_password[64];
-                    char newline[256];
-                    int len;
-
-                    // MUST read 5 fields now
-                    if (sscanf(line, "%d %s %s %d %d", &id, file_username, file_password, &active, &logged_in) == 5) {
-                        
-                        if (strcmp(file_username, username) == 0 && strcmp(file_password, password) == 0) {
-                            found_match = 1;
-                            
-                            if (active == 0) {
-                                result = 0; // Inactive
-                                // Rewrite original line
-                                len = snprintf(newline, sizeof(newline), "%d %s %s %d %d\n", id, file_username, file_password, active, logged_in);
-                            } else if (logged_in == 1) {
-                                result = -2; // Already logged in
-                                // Rewrite original line
-                                len = snprintf(newline, sizeof(newline), "%d %s %s %d %d\n", id, file_username, file_password, active, logged_in);
-                            } else {
-                                // SUCCESS: Mark logged_in = 1
-                                result = 1;
-                                logged_in = 1; 
-                                len = snprintf(newline, sizeof(newline), "%d %s %s %d %d\n", id, file_username, file_password, active, logged_in);
-                            }
-                            write(fd_write, newline, len);
-                            
-                        } else {
-                            // Not the target user: Rewrite original line
-                            len = snprintf(newline, sizeof(newline), "%d %s %s %d %d\n", id, file_username, file_password, active, logged_in);
-                            write(fd_write, newline, len);
-                        }
-                    } else {
-                        // Malformed line: write original line + newline
-                        write(fd_write, line, strlen(line));
-                        write(fd_write, "\n", 1);
-                    }
-                }
-            } else {
-                line[pos++] = buffer[i];
-            }
+/* line[i..len) a byte at a time, then the last field */
+static int rec_split_scalar(const char *line, size_t i, size_t len, RecField *f, int max, RecSplit *st) {
+    for (; i < len; i++) {
+        if (!rec_is_sep(line[i])) continue;
+        if (i > st->start) {
+            if (st->n == max) return st->n;
+            f[st->n].p = line + st->start;
+            f[st->n++].len = (int)(i - st->start);
         }
+        st->start = i + 1;
     }
+    if (len > st->start && st->n < max) {
+        f[st->n].p = line + st->start;
+        f[st->n++].len = (int)(len - st->start);
+    }
+    return st->n;
+}
 
-    close(fd_read);
-    close(fd_write);
+#ifdef REC_SIMD
+/* Vector loops from line[i]: return where the scalar tail starts,
+   or (size_t)-1 if max fields were taken */
+static size_t rec_split_sse2(const char *line, size_t i, size_t len, RecField *f, int max, RecSplit *st) {
+    const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), cr = _mm_set1_epi8('\r');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(line + i));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, sp),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, cr)));
+        if (rec_split_bits(line, i, (uint32_t)_mm_movemask_epi8(m), f, max, st) == -1)
+            return (size_t)-1;
+    }
+    return i;
+}
 
-    // Finalize: replace old file only if the user was found
-    if (found_match) {
-        rename(temp_file, filename);
-    } else {
-        unlink(temp_file);
+__attribute__((target("avx2")))
+static size_t rec_split_avx2(const char *line, size_t i, size_t len, RecField *f, int max, RecSplit *st) {
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), cr = _mm256_set1_epi8('\r');
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(line + i));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, cr)));
+        if (rec_split_bits(line, i, (uint32_t)_mm256_movemask_epi8(m), f, max, st) == -1)
+            return (size_t)-1;
     }
-    
-    return result;
+    // One 16-byte step may still fit. Done here rather than in
+    // rec_split_sse2: legacy SSE code right after 256-bit ops, with
+    // no vzeroupper between, pays a transition on every line.
+    if (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(line + i));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(sp)),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(tab)),
+                                 _mm_cmpeq_epi8(v, _mm256_castsi256_si128(cr))));
+        if (rec_split_bits(line, i, (uint32_t)_mm_movemask_epi8(m), f, max, st) == -1)
+            return (size_t)-1;
+        i += 16;
+    }
+    return i;
 }
 
-// In utils.c, ADD this new function
+static int rec_avx2 = -1;            // CPU has AVX2; -1 = not checked yet
+#endif
 
-/* =========================================================
-   MARK USER LOGGED OUT
-   ========================================================= */
-void mark_user_logged_out(const char *filename, const char *username) {
-    char temp_file[] = "temp_logout.txt";
-    int fd_read = open(filename, O_RDONLY);
-    if (fd_read < 0) return;
+/* Split line[0..len) into at most max fields separated by runs of
+   blanks, as sscanf's %s would. Returns the number of fields. */
+int rec_split(const char *line, size_t len, RecField *f, int max) {
+    RecSplit st = { 0, 0 };
+    size_t i = 0;
+#ifdef REC_SIMD
+    if (rec_avx2 < 0) rec_avx2 = __builtin_cpu_supports("avx2") != 0;
+    i = rec_avx2 ? rec_split_avx2(line, 0, len, f, max, &st) : rec_split_sse2(line, 0, len, f, max, &st);
+    if (i == (size_t)-1) return st.n;
+#endif
+    return rec_split_scalar(line, i, len, f, max, &st);
+}
 
-    int fd_write = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_write < 0) { close(fd_read); return; }
+/* Decimal integer at the start of the field (optional sign; like
+   %d, trailing characters are ignored). 0 on success, -1 if the
+   field does not start with a number. */
+int rec_int(RecField f, int *out) {
+    int i = 0, neg = 0;
+    if (i < f.len && (f.p[i] == '-' || f.p[i] == '+')) neg = (f.p[i++] == '-');
+    if (i >= f.len || f.p[i] < '0' || f.p[i] > '9') return -1;
+
+    long v = 0;
+    for (; i < f.len && f.p[i] >= '0' && f.p[i] <= '9'; i++)
+        if (v < 1000000000000L) v = v * 10 + (f.p[i] - '0');
+    *out = (int)(neg ? -v : v);
+    return 0;
+}
 
-    char buf[512], line[256];
-    ssize_t r;
-    int pos = 0;
-
-    while ((r = read(fd_read, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < r; ++i) {
-            if (buf[i] == '\n' || pos >= (int)sizeof(line) - 1) {
-                line[pos] = '\0';
-                pos = 0;
-
-                if (line[0] != '\0') {
-                    int id, active, logged_in;
-                    char user[64], pass[64];
-                    char newline[256];
-                    int len;
-
-                    // MUST read 5 fields
-                    if (sscanf(line, "%d %s %s %d %d", &id, user, pass, &active, &logged_in) == 5) {
-                        if (strcmp(user, username) == 0) {
-                            // Target user: write with logged_in = 0
-                            logged_in = 0;
-                            len = snprintf(newline, sizeof(newline), "%d %s %s %d %d\n", id, user, pass, active, logged_in);
-                        } else {
-                            // Other user: write original line
-                            len = snprintf(newline, sizeof(newline), "%d %s %s %d %d\n", id, user, pass, active, logged_in);
-                        }
-                        write(fd_write, newline, len);
-                    } else {
-                        // Malformed line: write original line + newline
-                        write(fd_write, line, strlen(line));
-                        write(fd_write, "\n", 1);
-                    }
-                }
-            } else {
-                line[pos++] = buf[i];
-            }
-        }
-    }
+/* Floating-point number at the start of the field. strtod() stops
+   at the separator, so the line must end in '\0' (LineReader lines
+   do). 0 on success, -1 if there is no number. */
+int rec_double(RecField f, double *out) {
+    char *end;
+    double v = strtod(f.p, &end);
+    if (end == f.p || end > f.p + f.len) return -1;
+    *out = v;
+    return 0;
+}
+
+/* 1 if the field is exactly s */
+int rec_eq(RecField f, const char *s) {
+    return strncmp(f.p, s, f.len) == 0 && s[f.len] == '\0';
+}
 
-    close(fd_read);
-    close(fd_write);
-    rename(temp_file, filename);
+/* Copy the field into dst as a string, truncated to fit */
+void rec_copy(RecField f, char *dst, size_t cap) {
+    size_t n = (size_t)f.len < cap - 1 ? (size_t)f.len : cap - 1;
+    memcpy(dst, f.p, n);
+    dst[n] = '\0';
 }
+
 /* =========================================================
-   ADD USER FUNCTION (open/write)
-   Adds a new record: <id> <username> <password>\n
+   SNAPSHOT READS
+   Pin the current generation of a file (its inode and length)
+   so a long read never sees, or waits for, later writers.
    ========================================================= */
-int add_user(const char *filename, const char *username, const char *password) {
-    int fd = open(filename, O_RDWR | O_CREAT, 0644);
+int snapshot_open(const char *filename, FileSnapshot *snap) {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
     if (fd < 0) {
-        perror("open");
-        return 0;
+        snap->fd = -1;
+        return -1;
     }
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        snap->fd = -1;
+        return -1;
+    }
+    line_reader_init(snap, fd, 0, st.st_size);
+    return 0;
+}
 
-    char buffer[256];
-    int id = 0, max_id = 0;
-    ssize_t n;
-    lseek(fd, 0, SEEK_SET);
-
-    // Find the highest ID
-    while ((n = read(fd, buffer, sizeof(buffer) - 1)) > 0) {
-        buffer[n] = '\0';
-        char *line = strtok(buffer, "\n");
-        while (line) {
-            sscanf(line, "%d", &id);
-            if (id > max_id)
-                max_id = id;
-            line = strtok(NULL, "\n");
-        }
+/* Raw bytes, never past the snapshot length; 0 at the end */
+ssize_t snapshot_read(FileSnapshot *snap, char *buf, size_t n) {
+    if (snap->len > 0) {
+        size_t k = snap->len < n ? snap->len : n;
+        memcpy(buf, snap->buf + snap->start, k);
+        snap->start += k;
+        snap->len -= k;
+        return k;
     }
+    if (snap->pos >= snap->end) return 0;
+    if ((off_t)n > snap->end - snap->pos) n = snap->end - snap->pos;
 
-    int new_id = max_id + 1;
-    char entry[256];
-     snprintf(entry, sizeof(entry), "%d %s %s %d %d\n", new_id, username, password, 1, 0);    // active=1 (default active)
+    ssize_t r;
+    while ((r = pread(snap->fd, buf, n, snap->pos)) == -1 && errno == EINTR)
+        ;
+    if (r > 0) snap->pos += r;
+    return r;
+}
 
-    // Append new entry
-    lseek(fd, 0, SEEK_END);
-    write(fd, entry, strlen(entry));
+/* Next line of the snapshot, as line_reader_next() */
+char *snapshot_next_line(FileSnapshot *snap, size_t *len) {
+    return line_reader_next(snap, len);
+}
 
-    close(fd);
-    return 1;
+void snapshot_close(FileSnapshot *snap) {
+    if (snap->fd >= 0) close(snap->fd);
+    snap->fd = -1;
 }
 
-/* ---------------------------
-   Helper: return base for a key
-   --------------------------- */
-static int base_for_key(const char *key) {
-    if (strcasecmp(key, "admin") == 0) return 100;
-    if (strcasecmp(key, "manager") == 0) return 200;
-    if (strcasecmp(key, "employee") == 0) return 300;
-    if (strcasecmp(key, "customer") == 0) return 400;
-    if (strcasecmp(key, "account") == 0) return 500;
-    if (strcasecmp(key, "loan") == 0) return 600;
-    if (strcasecmp(key, "feedback") == 0) return 700;
-    if (strcasecmp(key, "transaction") == 0) return 800;
-    return 1000;
-}
-
-/* ---------------------------
-   get_next_global_id(key)
-   - Atomically read/update id_tracker.txt under sem_userdb lock.
-   - Returns the new id (>= base), or -1 on error.
-   --------------------------- */
-   #ifdef SERVER_SIDE
-int get_next_global_id(const char *key) {
-    extern sem_t *sem_userdb; // declared in utils.h as extern
-    if (!key) return -1;
-
-    sem_wait(sem_userdb);
-
-    const char *tracker = "id_tracker.txt";
-    int fd = open(tracker, O_RDWR | O_CREAT, 0644);
+/* =========================================================
+   AUTHENTICATION FUNCTION (open/read)
+   Checks username/password in text DB file.
+   Format: <id> <username> <password>
+   ========================================================= */
+
+   /* ----------------------------------------------------------
+   check_existing_user()
+   Checks if a username already exists in the given file.
+   Returns 1 if found, 0 if not found, -1 on error.
+   ---------------------------------------------------------- */
+int check_existing_user(const char *filename, const char *username) {
+    int fd = open(filename, O_RDONLY);
     if (fd == -1) {
-        sem_post(sem_userdb);
-        return -1;
+        // If file doesn't exist, no duplicates.
+        return 0;
     }
 
-    struct stat st;
-    if (fstat(fd, &st) == -1) {
-        close(fd);
-        sem_post(sem_userdb);
-        return -1;
-    }
+    LineReader lr;
+    RecField f[2];
+    char *line;
+    size_t len;
+    line_reader_init(&lr, fd, 0, -1);
 
-    off_t sz = st.st_size;
-    char *buf = NULL;
-    if (sz > 0) {
-        buf = malloc(sz + 1);
-        if (!buf) {
-            close(fd);
-            sem_post(sem_userdb);
-            return -1;
-        }
-        ssize_t r = pread(fd, buf, sz, 0);
-        if (r < 0) {
-            free(buf);
+    while ((line = line_reader_next(&lr, &len)) != NULL) {
+        // second field is the username
+        if (rec_split(line, len, f, 2) == 2 && rec_eq(f[1], username)) {
             close(fd);
-            sem_post(sem_userdb);
-            return -1;
-        }
-        buf[r] = '\0';
-        sz = r;
-    } else {
-        buf = strdup(""); // empty file
-        sz = 0;
-    }
-
-    /* Build new content in memory: we will rewrite the whole file */
-    // We'll scan existing lines, find the key, update its value.
-    int found = 0;
-    int new_value = 0;
-
-    // Prepare an output buffer (grow as needed)
-    size_t outcap = sz + 256;
-    char *out = malloc(outcap + 1);
-    if (!out) { free(buf); close(fd); sem_post(sem_userdb); return -1; }
-    out[0] = '\0';
-    size_t outlen = 0;
-
-    // Parse each line
-    char *saveptr = NULL;
-    char *line = strtok_r(buf, "\n", &saveptr);
-    while (line) {
-        // trim leading spaces
-        while (*line == ' ' || *line == '\t') line++;
-
-        char wkey[128];
-        int val = 0;
-        if (sscanf(line, "%127s %d", wkey, &val) == 2) {
-            if (strcasecmp(wkey, key) == 0) {
-                // found the key — increment
-                found = 1;
-                new_value = val + 1;
-                // append updated line to out
-                int needed = snprintf(NULL, 0, "%s %d\n", wkey, new_value) + 1;
-                if (outlen + needed > outcap) {
-                    outcap = outcap + needed + 512;
-                    out = realloc(out, outcap + 1);
-                    if (!out) { free(buf); close(fd); sem_post(sem_userdb); return -1; }
-                }
-                outlen += snprintf(out + outlen, outcap - outlen + 1, "%s %d\n", wkey, new_value);
-            } else {
-                // copy existing line as-is
-                int needed = strlen(line) + 2;
-                if (outlen + needed > outcap) {
-                    outcap = outcap + needed + 512;
-                    out = realloc(out, outcap + 1);
-                    if (!out) { free(buf); close(fd); sem_post(sem_userdb); return -1; }
-                }
-                outlen += snprintf(out + outlen, outcap - outlen + 1, "%s\n", line);
-            }
-        } else {
-            // line malformed — preserve as-is
-            int needed = strlen(line) + 2;
-            if (outlen + needed > outcap) {
-                outcap = outcap + needed + 512;
-                out = realloc(out, outcap + 1);
-                if (!out) { free(buf); close(fd); sem_post(sem_userdb); return -1; }
-            }
-            outlen += snprintf(out + outlen, outcap - outlen + 1, "%s\n", line);
-        }
-        line = strtok_r(NULL, "\n", &saveptr);
-    }
-
-    if (!found) {
-        // Add initial base value then increment to base+1
-        int base = base_for_key(key);
-        new_value = base + 1;
-        // append new line
-        int needed = snprintf(NULL, 0, "%s %d\n", key, new_value) + 1;
-        if (outlen + needed > outcap) {
-            outcap = outcap + needed + 512;
-            out = realloc(out, outcap + 1);
-            if (!out) { free(buf); close(fd); sem_post(sem_userdb); return -1; }
+            return 1;  // found duplicate
         }
-        outlen += snprintf(out + outlen, outcap - outlen + 1, "%s %d\n", key, new_value);
     }
 
-    // Write out content atomically: truncate then write
-    if (ftruncate(fd, 0) == -1) {
-        free(buf); free(out); close(fd); sem_post(sem_userdb); return -1;
-    }
-    if (lseek(fd, 0, SEEK_SET) == -1) {
-        free(buf); free(out); close(fd); sem_post(sem_userdb); return -1;
+    close(fd);
+    return 0; // not found
+}
+
+/* =========================================================
+   ADD USER FUNCTION (open/write)
+   Appends a new record: <id> <username> <password> <active> <logged_in>\n
+   The caller allocates the id (the server uses id_next()).
+   ========================================================= */
+int add_user(const char *filename, int id, const char *username, const char *password) {
+    int fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("open");
+        return 0;
     }
-    ssize_t w = write(fd, out, strlen(out));
-    // optional: fsync(fd);
 
-    free(buf);
-    free(out);
-    close(fd);
-    sem_post(sem_userdb);
+    char entry[256];
+    int len = snprintf(entry, sizeof(entry), "%d %s %s %d %d\n", id, username, password, 1, 0);    // active=1 (default active)
+
+    // Append new entry
+    int ok = write(fd, entry, len) == len;
 
-    if (w < 0) return -1;
-    return new_value;
+    close(fd);
+    return ok;
 }
 
-#endif
 /* =========================================================
    GET NEXT ID FUNCTION (open/read)
    Returns max ID + 1 from file
@@ -455,12 +436,16 @@ int get_next_id(const char *filename) {
     int fd = open(filename, O_RDONLY | O_CREAT, 0644);
     if (fd == -1) return 1;
 
-    char line[512];
+    LineReader lr;
+    RecField f;
+    char *line;
+    size_t len;
     int id, max_id = 0;
 
     // read each line and extract only the first integer
-    while (read_line(fd, line, sizeof(line)) > 0) {
-        if (sscanf(line, "%d", &id) == 1) {  // only read the first number
+    line_reader_init(&lr, fd, 0, -1);
+    while ((line = line_reader_next(&lr, &len)) != NULL) {
+        if (rec_split(line, len, &f, 1) == 1 && rec_int(f, &id) == 0) {  // only read the first number
             if (id > max_id)
                 max_id = id;
         }
@@ -505,12 +490,15 @@ int atomic_add_user_text(const char *filename, const char *username, const char
     lock_file(fd, F_WRLCK);
 
     // find max id by scanning lines
-    char line[512];
+    LineReader lr;
+    RecField f;
+    char *line;
+    size_t line_len;
     int max_id = 0, id;
-    lseek(fd, 0, SEEK_SET);
+    line_reader_init(&lr, fd, 0, -1);
 
-    while (read_line(fd, line, sizeof(line)) > 0) {
-        if (sscanf(line, "%d", &id) == 1) {
+    while ((line = line_reader_next(&lr, &line_len)) != NULL) {
+        if (rec_split(line, line_len, &f, 1) == 1 && rec_int(f, &id) == 0) {
             if (id > max_id) max_id = id;
         }
     }
@@ -570,64 +558,369 @@ void error_exit(const char *msg) {
 
 /* =========================================================
    SOCKET MESSAGE HELPERS
-   For client-server communication
+   For client-server communication: raw text chunks, or frames
+   for connections that asked for them (see utils.h)
    ========================================================= */
+
+/* Server-side state of one client connection, indexed by fd */
+#define FRAME_IN_BUF (2 * (FRAME_HEADER + FRAME_MAX_ANSWER))
+#define MSG_OUT_BUF  65536               // held output (message_set_buffered)
+#define SEND_FILE_WINDOW (1 << 20)       // bytes per send_snapshot() step
+
+enum { CONN_NEW, CONN_TEXT, CONN_FRAMED };
+
+typedef struct {
+    int mode;
+    unsigned int id;                 // id of the answer being handled
+    char *in;                        // framed: received, not yet consumed
+    size_t start, len;
+    int buffered;                    // hold output until input is awaited
+    char *out;
+    size_t out_len;
+} MsgConn;
+
+static MsgConn **msg_conns = NULL;
+static int msg_conns_cap = 0;
+static pthread_once_t msg_conns_once = PTHREAD_ONCE_INIT;
+
+static void msg_conns_alloc(void) {
+    struct rlimit rl;
+    int cap = 65536;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > (rlim_t)cap)
+        cap = rl.rlim_cur > (1 << 20) ? (1 << 20) : (int)rl.rlim_cur;
+    msg_conns = calloc(cap, sizeof(MsgConn *));
+    if (msg_conns) msg_conns_cap = cap;
+}
+
+/* NULL: not a client connection (or past the table), plain text */
+static MsgConn *msg_conn(int fd) {
+    return (fd >= 0 && fd < msg_conns_cap) ? msg_conns[fd] : NULL;
+}
+
+void message_conn_open(int fd) {
+    pthread_once(&msg_conns_once, msg_conns_alloc);
+    if (fd < 0 || fd >= msg_conns_cap) return;
+    MsgConn *c = msg_conns[fd];
+    if (!c && !(c = msg_conns[fd] = calloc(1, sizeof(MsgConn)))) return;
+    c->mode = CONN_NEW;
+    c->id = 0;
+    c->start = c->len = 0;
+    c->buffered = 0;
+    c->out_len = 0;
+}
+
+int message_conn_framed(int fd) {
+    MsgConn *c = msg_conn(fd);
+    return c && c->mode == CONN_FRAMED;
+}
+
+unsigned int message_request_id(int fd) {
+    MsgConn *c = msg_conn(fd);
+    return c ? c->id : 0;
+}
+
+static int (*send_wait)(int fd) = NULL;
+
+void set_send_wait(int (*wait_fn)(int fd)) {
+    send_wait = wait_fn;
+}
+
+/* Wait until a full non-blocking socket can take more; -1 if it
+   never will (a blocking socket timed out, or the wait gave up) */
+static int send_blocked(int sockfd) {
+    if ((errno != EAGAIN && errno != EWOULDBLOCK) || !send_wait) return -1;
+    return send_wait(sockfd);
+}
+
+/* Write every byte or fail; no SIGPIPE for a vanished peer */
+static int send_all(int sockfd, struct iovec *iov, int iovcnt) {
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = iovcnt;
+    while (mh.msg_iovlen > 0) {
+        ssize_t n = sendmsg(sockfd, &mh, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (send_blocked(sockfd) == 0) continue;
+            return -1;
+        }
+        while (mh.msg_iovlen > 0 && (size_t)n >= mh.msg_iov->iov_len) {
+            n -= mh.msg_iov->iov_len;
+            mh.msg_iov++;
+            mh.msg_iovlen--;
+        }
+        if (mh.msg_iovlen > 0) {
+            mh.msg_iov->iov_base = (char *)mh.msg_iov->iov_base + n;
+            mh.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static void frame_header(unsigned char *hdr, int type, unsigned int id, size_t len) {
+    hdr[0] = FRAME_MAGIC0;
+    hdr[1] = FRAME_MAGIC1;
+    hdr[2] = (unsigned char)type;
+    hdr[3] = FRAME_VERSION;
+    hdr[4] = id >> 24; hdr[5] = id >> 16; hdr[6] = id >> 8; hdr[7] = id;
+    hdr[8] = len >> 24; hdr[9] = len >> 16; hdr[10] = len >> 8; hdr[11] = len;
+}
+
+int frame_parse_header(const unsigned char *p, FrameHeader *h) {
+    if (p[0] != FRAME_MAGIC0 || p[1] != FRAME_MAGIC1 || p[3] != FRAME_VERSION) return -1;
+    h->type = p[2];
+    h->id = (unsigned)p[4] << 24 | (unsigned)p[5] << 16 | (unsigned)p[6] << 8 | p[7];
+    h->len = (size_t)p[8] << 24 | (size_t)p[9] << 16 | (size_t)p[10] << 8 | p[11];
+    return 0;
+}
+
+int frame_send(int sockfd, int type, unsigned int id, const void *payload, size_t len) {
+    unsigned char hdr[FRAME_HEADER];
+    frame_header(hdr, type, id, len);
+    struct iovec iov[2] = { { hdr, FRAME_HEADER }, { (void *)payload, len } };
+    return send_all(sockfd, iov, len ? 2 : 1);
+}
+
+int message_flush(int fd) {
+    MsgConn *c = msg_conn(fd);
+    if (!c || c->out_len == 0) return 0;
+    struct iovec iov = { c->out, c->out_len };
+    c->out_len = 0;
+    return send_all(fd, &iov, 1);
+}
+
+void message_set_buffered(int fd, int on) {
+    MsgConn *c = msg_conn(fd);
+    if (!c) return;
+    if (on && !c->out && !(c->out = malloc(MSG_OUT_BUF))) return;   // unbuffered then
+    if (!on) message_flush(fd);
+    c->buffered = on;
+}
+
+/* Output for a client: header (framed) + text, held or sent now */
+static int conn_output(MsgConn *c, int sockfd, int type, unsigned int id,
+                       const char *msg, size_t len) {
+    unsigned char hdr[FRAME_HEADER];
+    size_t hlen = 0;
+    if (c && c->mode == CONN_FRAMED) {
+        frame_header(hdr, type, id, len);
+        hlen = FRAME_HEADER;
+    }
+
+    if (c && c->buffered) {
+        if (c->out_len + hlen + len <= MSG_OUT_BUF) {
+            memcpy(c->out + c->out_len, hdr, hlen);
+            memcpy(c->out + c->out_len + hlen, msg, len);
+            c->out_len += hlen + len;
+            return 0;
+        }
+        // Full: what is held and this message go out in one write
+        struct iovec iov[3] = { { c->out, c->out_len }, { hdr, hlen }, { (void *)msg, len } };
+        c->out_len = 0;
+        return send_all(sockfd, iov, 3);
+    }
+    struct iovec iov[2] = { { hdr, hlen }, { (void *)msg, len } };
+    return hlen ? send_all(sockfd, iov, 2) : send_all(sockfd, iov + 1, 1);
+}
+
 int send_message(int sockfd, const char *msg) {
     if (!msg) return -1;
-    size_t len = strlen(msg);
-    ssize_t sent = write(sockfd, msg, len);
-    if (sent < 0) {
+    MsgConn *c = msg_conn(sockfd);
+    if (conn_output(c, sockfd, FRAME_TEXT, c ? c->id : 0, msg, strlen(msg)) < 0) {
         perror("Send failed");
         return -1;
     }
     return 0;
 }
 
-int receive_message(int sockfd, char *buffer, size_t size) {
-    if (!buffer || size == 0) return -1;
-    ssize_t n = read(sockfd, buffer, size - 1);
-    if (n <= 0) {
-        return 0; // connection closed or error
+int send_message_id(int sockfd, unsigned int id, const char *msg) {
+    if (!msg) return -1;
+    if (conn_output(msg_conn(sockfd), sockfd, FRAME_TEXT, id, msg, strlen(msg)) < 0) {
+        perror("Send failed");
+        return -1;
     }
-    buffer[n] = '\0';
-    return 1;
+    return 0;
 }
 
-#include <sys/stat.h>  // make sure this is present at top of utils.c
+/* 'n' bytes of the snapshot from the page cache to the socket;
+   copied through the snapshot's buffer if sendfile() cannot do it */
+static int send_snapshot_step(int sockfd, FileSnapshot *snap, size_t n) {
+    while (n > 0) {
+        off_t off = snap->pos;
+        ssize_t r = sendfile(sockfd, snap->fd, &off, n);
+        if (r == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            r = snapshot_read(snap, snap->buf, n < LINE_READER_BUF ? n : LINE_READER_BUF);
+            struct iovec iov = { snap->buf, r > 0 ? (size_t)r : 0 };
+            if (r <= 0 || send_all(sockfd, &iov, 1) == -1) return -1;
+        } else if (r > 0) {
+            snap->pos = off;
+        } else if (r == -1 && (errno == EINTR || send_blocked(sockfd) == 0)) {
+            continue;
+        } else {
+            return -1;               // client gone, or the file shrank
+        }
+        n -= r;
+    }
+    return 0;
+}
 
-int get_next_global_id(const char *context) {
-    (void)context;  // context optional for debugging
-    const char *counter_file = "global_id_counter.txt";
-    int fd = open(counter_file, O_RDWR | O_CREAT, 0644);
-    if (fd < 0) {
-        perror("open global_id_counter.txt");
-        return 1;
+/* ------------------------------------------------------------
+   Send the rest of a snapshot to a client, SEND_FILE_WINDOW bytes
+   per sendfile() step (one FRAME_TEXT per step when framed).
+   Output held so far goes out first. 0 on success, -1 on error.
+   A step that fails part way leaves a frame (or text) the client
+   can never complete, so the connection is shut down rather than
+   left for the next reply to land in the middle of it.
+   ------------------------------------------------------------ */
+int send_snapshot(int sockfd, FileSnapshot *snap) {
+    MsgConn *c = msg_conn(sockfd);
+    if (snap->len > 0) {             // already read ahead by the line reader
+        if (conn_output(c, sockfd, FRAME_TEXT, c ? c->id : 0, snap->buf + snap->start, snap->len) == -1)
+            return -1;
+        snap->start = snap->len = 0;
+    }
+    if (message_flush(sockfd) == -1) return -1;
+
+    while (snap->pos < snap->end) {
+        size_t n = snap->end - snap->pos;
+        if (n > SEND_FILE_WINDOW) n = SEND_FILE_WINDOW;
+        if (c && c->mode == CONN_FRAMED) {
+            unsigned char hdr[FRAME_HEADER];
+            frame_header(hdr, FRAME_TEXT, c->id, n);
+            struct iovec iov = { hdr, FRAME_HEADER };
+            if (send_all(sockfd, &iov, 1) == -1) goto broken;
+        }
+        if (send_snapshot_step(sockfd, snap, n) == -1) goto broken;
     }
+    return 0;
 
-    //sem_wait(sem_userdb); // lock globally while updating ID
+broken:
+    shutdown(sockfd, SHUT_RDWR);
+    return -1;
+}
+
+static int (*receive_wait)(int fd) = NULL;
+
+void set_receive_wait(int (*wait_fn)(int fd)) {
+    receive_wait = wait_fn;
+}
 
-    // Read last ID
-    char buf[32];
-    int last_id = 0;
-    ssize_t n = read(fd, buf, sizeof(buf) - 1);
-    if (n > 0) {
-        buf[n] = '\0';
-        last_id = atoi(buf);
+/* One read of whatever has arrived; 0 on EOF or error.
+   Held output goes out before waiting: the client may need it
+   to send anything more. */
+static ssize_t receive_some(int sockfd, char *buf, size_t n) {
+    MsgConn *c = msg_conn(sockfd);
+    ssize_t r;
+    while ((r = recv(sockfd, buf, n, MSG_DONTWAIT)) == -1 &&
+           (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        if (errno == EINTR) continue;
+        if (c && c->out_len > 0 && message_flush(sockfd) == -1) return 0;
+        if (receive_wait) {
+            // Let the hook wait for input
+            if (receive_wait(sockfd) == -1) return 0;
+        } else {
+            while ((r = recv(sockfd, buf, n, 0)) == -1 && errno == EINTR)
+                ;
+            break;
+        }
     }
+    return r < 0 ? 0 : r;
+}
 
-    // Increment and save
-    int new_id = last_id + 1;
-    lseek(fd, 0, SEEK_SET);
-    ftruncate(fd, 0);
+/* Next whole frame of a framed connection, consumed from c->in.
+   *payload points into the buffer until the next call.
+   Returns 1, or 0 on EOF or a malformed frame. */
+static int frame_next(MsgConn *c, int sockfd, FrameHeader *h, char **payload) {
+    size_t need = FRAME_HEADER;
+    int have_header = 0;
+    for (;;) {
+        if (!have_header && c->len >= FRAME_HEADER) {
+            if (frame_parse_header((unsigned char *)c->in + c->start, h) == -1 ||
+                h->len > FRAME_MAX_ANSWER)
+                return 0;
+            need = FRAME_HEADER + h->len;
+            have_header = 1;
+        }
+        if (have_header && c->len >= need) break;
 
-    char new_id_str[32];
-    snprintf(new_id_str, sizeof(new_id_str), "%d\n", new_id);
-    write(fd, new_id_str, strlen(new_id_str));
+        if (c->start + c->len == FRAME_IN_BUF) {
+            memmove(c->in, c->in + c->start, c->len);
+            c->start = 0;
+        }
+        ssize_t n = receive_some(sockfd, c->in + c->start + c->len,
+                                 FRAME_IN_BUF - c->start - c->len);
+        if (n <= 0) return 0;
+        c->len += n;
+    }
+    *payload = c->in + c->start + FRAME_HEADER;
+    c->start += need;
+    c->len -= need;
+    if (c->len == 0) c->start = 0;
+    return 1;
+}
 
-    //sem_post(sem_userdb);
+/* A whole frame is waiting in c->in */
+static int frame_buffered(const MsgConn *c) {
+    FrameHeader h;
+    return c->len >= FRAME_HEADER &&
+           frame_parse_header((unsigned char *)c->in + c->start, &h) == 0 &&
+           c->len >= FRAME_HEADER + h.len;
+}
 
-    close(fd);
-    return new_id;
+int message_pending(int fd) {
+    MsgConn *c = msg_conn(fd);
+    return c && c->mode == CONN_FRAMED && frame_buffered(c);
+}
+
+/* Framed receive_message(): take the next answer. The client is
+   prompted only when none is waiting already (it is pipelining). */
+static int receive_frame(MsgConn *c, int sockfd, char *buffer, size_t size) {
+    FrameHeader h;
+    char *payload;
+    if (!frame_buffered(c) && conn_output(c, sockfd, FRAME_PROMPT, c->id, "", 0) == -1)
+        return 0;
+    for (;;) {
+        if (!frame_next(c, sockfd, &h, &payload)) return 0;
+        if (h.type != FRAME_ANSWER) continue;
+        size_t n = h.len < size - 1 ? h.len : size - 1;   // longer answers are cut
+        memcpy(buffer, payload, n);
+        buffer[n] = '\0';
+        c->id = h.id;
+        return 1;
+    }
 }
 
+int receive_message(int sockfd, char *buffer, size_t size) {
+    if (!buffer || size == 0) return -1;
+    MsgConn *c = msg_conn(sockfd);
+    if (c && c->mode == CONN_FRAMED)
+        return receive_frame(c, sockfd, buffer, size);
+
+    ssize_t n = receive_some(sockfd, buffer, size - 1);
+    if (n <= 0) {
+        return 0; // connection closed or error
+    }
 
+    // First input on a client connection: a hello frame switches
+    // it to framed mode, anything else keeps it in text mode
+    if (c && c->mode == CONN_NEW) {
+        c->mode = CONN_TEXT;
+        if (n >= 2 && (unsigned char)buffer[0] == FRAME_MAGIC0 &&
+            (unsigned char)buffer[1] == FRAME_MAGIC1) {
+            if ((size_t)n > FRAME_IN_BUF || (!c->in && !(c->in = malloc(FRAME_IN_BUF)))) return 0;
+            memcpy(c->in, buffer, n);
+            c->start = 0;
+            c->len = n;
+
+            FrameHeader h;
+            char *payload;
+            if (!frame_next(c, sockfd, &h, &payload) || h.type != FRAME_HELLO) return 0;
+            c->mode = CONN_FRAMED;
+            if (conn_output(c, sockfd, FRAME_HELLO, 0, "", 0) == -1) return 0;
+            return receive_frame(c, sockfd, buffer, size);
+        }
+    }
+    buffer[n] = '\0';
+    return 1;
+}
@@ -12,14 +12,16 @@
 /* ---------- File Locking ---------- */
 int lock_file(int fd, int lock_type);    // F_RDLCK or F_WRLCK
 int unlock_file(int fd);
-
-/* ---------- User Authentication ---------- */
-int validate_login(const char *filename, const char *username, const char *password);
+int lock_record(int fd, off_t start, off_t len, int lock_type);
+int unlock_record(int fd, off_t start, off_t len);
+// Open-file-description locks: owned by the open() that made fd, not
+// by the process, so they also exclude threads using their own open()
+int lock_record_ofd(int fd, off_t start, off_t len, int lock_type);
+int unlock_record_ofd(int fd, off_t start, off_t len);
 
 /* ---------- User Management ---------- */
-int add_user(const char *filename, const char *username, const char *password);
+int add_user(const char *filename, int id, const char *username, const char *password);
 int get_next_id(const char *filename);
-int get_next_global_id(const char *filename);
 
 
 /* ---------- Input Utilities ---------- */
@@ -32,8 +34,103 @@ void error_exit(const char *msg);
 /* ---------- Socket Message Helpers ---------- */
 int send_message(int sockfd, const char *msg);
 int receive_message(int sockfd, char *buffer, size_t size);
+// Called by receive_message() when no input is waiting yet; it must
+// return once fd is readable (or -1 to give up). Unset: read() blocks.
+void set_receive_wait(int (*wait_fn)(int fd));
+// Called when a non-blocking socket cannot take more output; it must
+// return once fd is writable (or -1 to give up). Unset: the send fails.
+void set_send_wait(int (*wait_fn)(int fd));
+// Server: a new client connection on fd (forgets the last one's mode)
+void message_conn_open(int fd);
+int message_conn_framed(int fd);
+unsigned int message_request_id(int fd);     // id of the last framed answer
+int message_pending(int fd);                 // a framed answer is already here
+// Like send_message(), but a framed reply is tagged with request 'id'
+int send_message_id(int sockfd, unsigned int id, const char *msg);
+// Buffered: output is held (and coalesced) until message_flush(),
+// until receive_message() has to wait for input, or until the buffer
+// is full (then it goes out together with the message that overflowed)
+void message_set_buffered(int fd, int on);
+int message_flush(int fd);
 int check_existing_user(const char *filename, const char *username);
-ssize_t read_line(int fd, char *buf, size_t maxlen);
-void mark_user_logged_out(const char *filename, const char *username);
+
+/* ---------- Framed Protocol ----------
+   A client that opens with a FRAME_HELLO frame switches its
+   connection from raw text chunks to frames; other clients stay in
+   text mode. A frame is a FRAME_HEADER-byte header (magic, type,
+   version, request id, payload length; big-endian) and the payload.
+   The server sends output as FRAME_TEXT and a FRAME_PROMPT when it
+   waits for input; the client answers with FRAME_ANSWERs, one per
+   prompt or several ahead of time (no prompts are sent for answers
+   that are already there). Server frames carry the id of the
+   answer being handled.
+   send_message()/receive_message() do this transparently. */
+#define FRAME_MAGIC0      0xFB           // never valid in UTF-8 text
+#define FRAME_MAGIC1      0x42
+#define FRAME_VERSION     1
+#define FRAME_HEADER      12
+#define FRAME_MAX_ANSWER  4096           // largest client payload
+
+enum { FRAME_HELLO = 1, FRAME_TEXT, FRAME_PROMPT, FRAME_ANSWER };
+
+typedef struct {
+    int type;
+    unsigned int id;
+    size_t len;
+} FrameHeader;
+
+int frame_parse_header(const unsigned char *p, FrameHeader *h);
+int frame_send(int sockfd, int type, unsigned int id, const void *payload, size_t len);
+
+/* ---------- Buffered Line Reader ----------
+   Reads a file in LINE_READER_BUF blocks with pread() and hands out
+   one line at a time as a pointer into its own buffer: '\n' replaced
+   by '\0', writable (strtok is fine), valid until the next call.
+   A line longer than the buffer comes out in buffer-sized pieces. */
+#define LINE_READER_BUF 65536
+
+typedef struct {
+    int fd;
+    off_t pos;          // next offset to read
+    off_t end;          // stop here; -1 = end of file
+    size_t start, len;  // unread bytes in buf
+    char buf[LINE_READER_BUF + 1];
+} LineReader;
+
+void line_reader_init(LineReader *lr, int fd, off_t start, off_t end);
+char *line_reader_next(LineReader *lr, size_t *len);
+
+/* ---------- Record Tokenizer ----------
+   Splits a text-database line into fields without copying or
+   modifying it: each field is a (pointer, length) view into the
+   line. Separators are found 16 bytes at a time with SSE2, or 32
+   with AVX2 when the CPU has it (checked at run time); other
+   targets use a scalar loop. LineReader finds newlines with memchr. */
+#define REC_MAX_FIELDS 16
+
+typedef struct {
+    const char *p;
+    int len;
+} RecField;
+
+int rec_split(const char *line, size_t len, RecField *f, int max);
+int rec_int(RecField f, int *out);
+int rec_double(RecField f, double *out);
+int rec_eq(RecField f, const char *s);
+void rec_copy(RecField f, char *dst, size_t cap);
+
+/* ---------- Snapshot Reads ----------
+   Data files are only ever replaced by rename() or appended to, so an
+   open fd plus the length seen at open time is a consistent snapshot.
+   Take the file's lock just around snapshot_open(); read without it.
+   A snapshot is a LineReader bounded by that length. */
+typedef LineReader FileSnapshot;
+
+int snapshot_open(const char *filename, FileSnapshot *snap);
+ssize_t snapshot_read(FileSnapshot *snap, char *buf, size_t n);
+char *snapshot_next_line(FileSnapshot *snap, size_t *len);
+void snapshot_close(FileSnapshot *snap);
+// Rest of the snapshot to a client as text, with sendfile()
+int send_snapshot(int sockfd, FileSnapshot *snap);
 
 #endif // UTILS_H
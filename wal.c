@@ -0,0 +1,552 @@
+/* wal.c
+   Write-ahead log for balance mutations (account_wal.log).
+
+   Every deposit, withdrawal and transfer appends one fixed-size
+   WalRecord carrying the new balances of the accounts it touched.
+   Records are buffered in shared memory and made durable by group
+   commit: the first session that needs its record on disk becomes the
+   leader, writes everything buffered so far and issues a single
+   fdatasync(); sessions that arrive meanwhile wait for that flush (or
+   the next one) instead of syncing on their own.
+
+   The leader also applies the batch it made durable: it writes the
+   logged balances back to account_db.dat (so the data file never
+   gets ahead of the log) and appends the batch's ledger rows with
+   one ledger_append(). A money operation therefore holds its account
+   lock once, and its balance and ledger rows can only appear together.
+
+   If a flush fails, the log is fenced until restart: that batch and
+   every record after it fail (wal_commit() returns -1, the caller
+   takes its change back out of the account table), nothing more is
+   logged, and no failed record is ever applied or left in the log.
+
+   Each record also carries the ids of the ledger rows it produces,
+   so after a crash wal_recover() can both restore balances and
+   re-append ledger rows that never made it to the ledger.
+   The log starts with a WalFileHeader written at every checkpoint:
+   at startup, and by the leader whenever the log has grown past
+   WAL_CHECKPOINT_BYTES, so recovery never reads more than that.
+   Designed to be included directly into server.c (no header).
+*/
+
+#include "utils.h"
+#include "Struct.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define WAL_FILE        "account_wal.log"
+#define WAL_TMP_FILE    "account_wal.log.tmp"
+#define WAL_MAGIC       0x324C4157u      // "WAL2"
+#define WAL_HDR_MAGIC   0x504C4157u      // "WALP"
+#define WAL_HDR_MAGIC_TEXT 0x484C4157u   // "WALH": ledger_end was a text ledger offset
+#define WAL_BUF_RECORDS 512              // records buffered between flushes
+#define WAL_SCAN_CHUNK  256              // records read per pread() during recovery
+#define WAL_CHECKPOINT_BYTES (4 << 20)   // log size that triggers a checkpoint
+
+#define WAL_DEPOSIT   1
+#define WAL_WITHDRAW  2
+#define WAL_TRANSFER  3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;                   // WAL_DEPOSIT / WAL_WITHDRAW / WAL_TRANSFER
+    uint64_t lsn;                    // log sequence number, strictly increasing
+    int64_t  timestamp;
+    int32_t  amount;
+    int32_t  nacc;                   // accounts touched (1, or 2 for transfers)
+    int32_t  tx_id;                  // ledger id of row 0 (row i is tx_id + i)
+    uint32_t checksum;               // FNV-1a of the record with checksum = 0
+    int32_t  slot[2];                // account table slots
+    double   new_balance[2];         // balances after the operation
+    char     username[2][MAX_USERNAME];
+} WalRecord;
+
+typedef struct {
+    uint32_t magic;                  // WAL_HDR_MAGIC
+    int32_t  next_tx_id;             // first ledger id not handed out yet
+    uint64_t ledger_end;             // ledger position (loc) at checkpoint
+} WalFileHeader;
+
+typedef struct {
+    sem_t lock;                      // protects every field below
+    sem_t flushed;                   // followers sleep here during a flush
+    int waiters;
+    int flushing;                    // a leader is writing right now
+    uint64_t failed_lsn;             // sticky: records from here on failed (0 = none)
+    uint64_t next_lsn;
+    uint64_t durable_lsn;            // everything <= this is settled (on disk or failed)
+    int next_tx_id;                  // next ledger id
+    int nbuf;
+    WalRecord buf[WAL_BUF_RECORDS];
+} WalShared;
+
+int wal_commit(uint64_t lsn);
+
+static WalShared *wal = NULL;           // shared by every session
+static uint64_t *wal_slot_lsn = NULL;   // last lsn that changed each account slot
+static int wal_fd = -1;
+static int wal_start_tx_id = 1;         // set by wal_recover(), used by wal_init()
+
+// Only one leader flushes at a time, so single staging buffers are enough
+static WalRecord wal_flush_buf[WAL_BUF_RECORDS];
+static LedgerRecord wal_flush_rows[WAL_BUF_RECORDS * 2];
+
+static uint32_t wal_checksum(const WalRecord *rec) {
+    WalRecord tmp = *rec;
+    tmp.checksum = 0;
+    uint32_t h = 2166136261u;
+    const unsigned char *p = (const unsigned char *)&tmp;
+    for (size_t i = 0; i < sizeof(tmp); i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* ------------------------------------------------------------
+   Map the shared WAL state and open the log for appending.
+   Must run in the parent, after account_table_load() and
+   wal_recover().
+   ------------------------------------------------------------ */
+int wal_init(void) {
+    wal = mmap(NULL, sizeof(WalShared), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    wal_slot_lsn = mmap(NULL, (size_t)ACCOUNT_TABLE_CAP * sizeof(uint64_t),
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (wal == MAP_FAILED || wal_slot_lsn == MAP_FAILED) {
+        perror("mmap wal");
+        return -1;
+    }
+
+    if (sem_init(&wal->lock, 1, 1) == -1 || sem_init(&wal->flushed, 1, 0) == -1) {
+        perror("sem_init wal");
+        return -1;
+    }
+    wal->next_lsn = 1;
+    wal->durable_lsn = 0;
+    wal->next_tx_id = wal_start_tx_id;
+
+    wal_fd = open(WAL_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (wal_fd == -1) {
+        perror("open account_wal.log");
+        return -1;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------
+   Log the current balances of one or two account slots.
+   Caller holds the lock protecting those slots and has already
+   applied the change in the table, so log order == apply order.
+   The record (with its ledger ids) is copied to *out.
+   Returns the record's lsn, or 0 if nothing was logged (the log
+   is fenced after a failed flush): the caller must then undo its
+   change before releasing the lock.
+   ------------------------------------------------------------ */
+uint64_t wal_log_balances(int type, int amount, int slot_a, int slot_b, WalRecord *out) {
+    WalRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = WAL_MAGIC;
+    rec.type = type;
+    rec.timestamp = time(NULL);
+    rec.amount = amount;
+    rec.nacc = (slot_b >= 0) ? 2 : 1;
+
+    int slots[2] = { slot_a, slot_b };
+    for (int i = 0; i < rec.nacc; i++) {
+        CustomerAccount *acc = account_table_get(slots[i]);
+        rec.slot[i] = slots[i];
+        rec.new_balance[i] = acc->balance;
+        strncpy(rec.username[i], acc->username, MAX_USERNAME - 1);
+    }
+
+    for (;;) {
+        sem_wait(&wal->lock);
+        if (wal->failed_lsn != 0) {
+            sem_post(&wal->lock);
+            return 0;
+        }
+        if (wal->nbuf < WAL_BUF_RECORDS) {
+            rec.lsn = wal->next_lsn++;
+            rec.tx_id = wal->next_tx_id;
+            wal->next_tx_id += rec.nacc;
+            rec.checksum = wal_checksum(&rec);
+            wal->buf[wal->nbuf++] = rec;
+            for (int i = 0; i < rec.nacc; i++)
+                __atomic_store_n(&wal_slot_lsn[rec.slot[i]], rec.lsn, __ATOMIC_RELEASE);
+            sem_post(&wal->lock);
+            *out = rec;
+            return rec.lsn;
+        }
+        uint64_t pending = wal->next_lsn - 1;
+        sem_post(&wal->lock);
+
+        // Buffer full: push it out, then retry
+        if (wal_commit(pending) == -1) return 0;
+    }
+}
+
+/* Write n records and sync them; 0 on success. On failure the log
+   is cut back to where it was, so a restart cannot replay records
+   that were reported as failed. */
+static int wal_flush_records(const WalRecord *recs, int n) {
+    size_t want = (size_t)n * sizeof(WalRecord);
+    size_t done = 0;
+    off_t start = lseek(wal_fd, 0, SEEK_END);
+    while (done < want) {
+        ssize_t w = write(wal_fd, (const char *)recs + done, want - done);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += w;
+    }
+    if (done == want && fdatasync(wal_fd) == 0) return 0;
+
+    perror("account_wal.log flush");
+    if (start == -1 || ftruncate(wal_fd, start) == -1 || fdatasync(wal_fd) == -1)
+        perror("account_wal.log: cannot drop failed records");
+    return -1;
+}
+
+/* ------------------------------------------------------------
+   Ledger rows. Row i of a record is the one for account i.
+   ------------------------------------------------------------ */
+static void wal_ledger_record(const WalRecord *rec, int i, LedgerRecord *out) {
+    memset(out, 0, sizeof(*out));
+    out->tx.tx_id = rec->tx_id + i;
+    out->tx.amount = rec->amount;
+    if      (rec->type == WAL_DEPOSIT)  out->tx.tx_type = LEDGER_DEPOSIT;
+    else if (rec->type == WAL_WITHDRAW) out->tx.tx_type = LEDGER_WITHDRAW;
+    else {
+        out->tx.tx_type = (i == 0) ? LEDGER_TRANSFER_OUT : LEDGER_TRANSFER_IN;
+        snprintf(out->tx.remark, sizeof(out->tx.remark), "%s %s",
+                 (i == 0) ? "to" : "from", rec->username[1 - i]);
+    }
+
+    strncpy(out->username, rec->username[i], MAX_USERNAME - 1);
+    out->timestamp = rec->timestamp;
+    out->balance = rec->new_balance[i];
+
+    int slot = rec->slot[i];
+    if (slot < 0 || slot >= acct_table->count ||
+        strcmp(acct_table->rec[slot].username, rec->username[i]) != 0)
+        slot = account_table_find(rec->username[i]);
+    if (slot >= 0) {
+        out->tx.account_no = acct_table->rec[slot].account_no;
+        out->tx.user_id = acct_table->rec[slot].user_id;
+    }
+}
+
+/* ------------------------------------------------------------
+   Checkpoint while serving. Everything in the log has been applied,
+   so once account_db.dat and the ledger are durable the log can
+   start over with a header holding the next ledger id and where
+   the ledger ends. The log is cut to nothing before the header is
+   appended: a crash in between leaves an empty log, which recovery
+   reads as nothing to replay. Called by the leader, which owns the
+   flush, so no one else writes the log meanwhile. If the log was
+   cut but the header could not be written, the log is fenced.
+   ------------------------------------------------------------ */
+static int wal_checkpoint_live(void) {
+    sem_wait(&wal->lock);
+    WalFileHeader hdr = { WAL_HDR_MAGIC, wal->next_tx_id, 0 };
+    int rc = -1;
+    if (fsync(acct_fd) == 0 && ledger_sync() == 0) {
+        hdr.ledger_end = ledger_end();
+        if (ftruncate(wal_fd, 0) == 0) {
+            if (write(wal_fd, &hdr, sizeof(hdr)) == sizeof(hdr) && fdatasync(wal_fd) == 0)
+                rc = 0;
+            else
+                wal->failed_lsn = wal->next_lsn;
+        }
+    }
+    sem_post(&wal->lock);
+    if (rc == -1) perror("account_wal.log checkpoint");
+    return rc;
+}
+
+/* ------------------------------------------------------------
+   Apply a batch that is now durable: write each account's newest
+   logged balance back to account_db.dat and append all ledger rows
+   in log order, then checkpoint if the log has grown too big.
+   Runs in the leader while it still owns the flush, so batches are
+   applied in the order they were logged.
+   Returns 0, or -1 on an I/O error; *rolled as ledger_append_rows().
+   ------------------------------------------------------------ */
+static int wal_apply_batch(const WalRecord *recs, int n, int *rolled) {
+    int rc = 0, nrows = 0;
+    for (int r = 0; r < n; r++) {
+        for (int i = 0; i < recs[r].nacc; i++) {
+            // A later record for the slot (this batch or the next) writes it
+            int slot = recs[r].slot[i];
+            if (__atomic_load_n(&wal_slot_lsn[slot], __ATOMIC_ACQUIRE) == recs[r].lsn &&
+                account_table_persist_balance(slot, recs[r].new_balance[i]) == -1)
+                rc = -1;
+            wal_ledger_record(&recs[r], i, &wal_flush_rows[nrows++]);
+        }
+    }
+
+    *rolled = 0;
+    if (nrows > 0 && ledger_append_rows(wal_flush_rows, nrows, rolled) == -1) rc = -1;
+
+    // Only a fully applied log may be dropped
+    if (rc == 0 && lseek(wal_fd, 0, SEEK_END) >= WAL_CHECKPOINT_BYTES)
+        wal_checkpoint_live();
+    return rc;
+}
+
+/* ------------------------------------------------------------
+   Block until lsn is durable. Returns 0, or -1 if its record was
+   not written (and will never be applied): the caller must undo
+   the change it logged.
+   ------------------------------------------------------------ */
+int wal_commit(uint64_t lsn) {
+    for (;;) {
+        sem_wait(&wal->lock);
+
+        if (wal->durable_lsn >= lsn) {
+            int failed = wal->failed_lsn != 0 && lsn >= wal->failed_lsn;
+            sem_post(&wal->lock);
+            return failed ? -1 : 0;
+        }
+
+        if (wal->flushing) {
+            // Someone else is syncing; wait for them and re-check
+            wal->waiters++;
+            sem_post(&wal->lock);
+            while (sem_wait(&wal->flushed) == -1 && errno == EINTR)
+                ;
+            continue;
+        }
+
+        if (wal->failed_lsn != 0) {
+            // Fenced: what is still buffered fails without being written
+            wal->nbuf = 0;
+            wal->durable_lsn = wal->next_lsn - 1;
+            sem_post(&wal->lock);
+            continue;
+        }
+
+        // Become the leader for everything buffered so far
+        wal->flushing = 1;
+        int n = wal->nbuf;
+        memcpy(wal_flush_buf, wal->buf, (size_t)n * sizeof(WalRecord));
+        wal->nbuf = 0;
+        uint64_t upto = wal->next_lsn - 1;
+        sem_post(&wal->lock);
+
+        int rolled = 0;
+        int rc = wal_flush_records(wal_flush_buf, n);
+        if (rc == 0 && wal_apply_batch(wal_flush_buf, n, &rolled) == -1)
+            perror("wal apply");   // durable in the log; recovery redoes it
+
+        sem_wait(&wal->lock);
+        if (rc == -1) wal->failed_lsn = wal->durable_lsn + 1;
+        wal->durable_lsn = upto;
+        wal->flushing = 0;
+        while (wal->waiters > 0) {
+            wal->waiters--;
+            sem_post(&wal->flushed);
+        }
+        sem_post(&wal->lock);
+
+        // A new ledger month: the packer takes the cold segment
+        if (rolled) ledger_pack_request();
+    }
+}
+
+/* ------------------------------------------------------------
+   Crash recovery
+   ------------------------------------------------------------ */
+
+typedef int (*wal_visit_fn)(const WalRecord *rec, void *ctx);
+
+/* Feed every valid record from 'start' to fn, in log order.
+   Stops at the first torn or corrupt record (the tail of a crash).
+   Returns the number of records visited. */
+static int wal_scan(int fd, off_t start, wal_visit_fn fn, void *ctx) {
+    static WalRecord chunk[WAL_SCAN_CHUNK];
+    off_t off = start;
+    int n = 0;
+
+    for (;;) {
+        ssize_t r = pread(fd, chunk, sizeof(chunk), off);
+        if (r <= 0) break;
+        int got = r / sizeof(WalRecord);
+        for (int i = 0; i < got; i++) {
+            if (chunk[i].magic != WAL_MAGIC || chunk[i].checksum != wal_checksum(&chunk[i]) ||
+                chunk[i].nacc < 1 || chunk[i].nacc > 2)
+                return n;
+            if (fn(&chunk[i], ctx) == -1) return n;
+            n++;
+        }
+        if (got < WAL_SCAN_CHUNK) break;
+        off += r;
+    }
+    return n;
+}
+
+typedef struct {
+    unsigned char *dirty;            // account slots touched by the log
+    int lo, hi;                      // ledger ids covered: [lo, hi)
+    unsigned char *seen;             // ids of [lo, hi) already in the ledger
+    LedgerRecord *out;               // missing ledger rows
+    int restored, out_cap;
+} WalReplay;
+
+/* Pass 1: the last record touching an account holds its balance */
+static int wal_replay_balance(const WalRecord *rec, void *ctx) {
+    WalReplay *st = ctx;
+    for (int i = 0; i < rec->nacc; i++) {
+        int slot = rec->slot[i];
+        if (slot < 0 || slot >= acct_table->count ||
+            strcmp(acct_table->rec[slot].username, rec->username[i]) != 0)
+            slot = account_table_find(rec->username[i]);
+        if (slot < 0) continue;
+
+        acct_table->rec[slot].balance = rec->new_balance[i];
+        st->dirty[slot] = 1;
+    }
+
+    if (st->lo == 0 || rec->tx_id < st->lo) st->lo = rec->tx_id;
+    if (rec->tx_id + rec->nacc > st->hi) st->hi = rec->tx_id + rec->nacc;
+    return 0;
+}
+
+/* Pass 2: queue the rows the ledger does not have */
+static int wal_replay_ledger(const WalRecord *rec, void *ctx) {
+    WalReplay *st = ctx;
+    for (int i = 0; i < rec->nacc; i++) {
+        if (st->seen[rec->tx_id + i - st->lo]) continue;
+
+        if (st->restored == st->out_cap) {
+            int cap = st->out_cap ? st->out_cap * 2 : 256;
+            LedgerRecord *p = realloc(st->out, (size_t)cap * sizeof(LedgerRecord));
+            if (!p) return -1;
+            st->out = p;
+            st->out_cap = cap;
+        }
+        wal_ledger_record(rec, i, &st->out[st->restored++]);
+    }
+    return 0;
+}
+
+/* ledger_scan_ids() callback: the row's id is already in the ledger */
+static int wal_mark_seen(const LedgerRecord *row, void *ctx) {
+    WalReplay *st = ctx;
+    st->seen[row->tx.tx_id - st->lo] = 1;
+    return 0;
+}
+
+/* Rewrite the log as an empty checkpoint (header only) */
+static int wal_checkpoint(int next_tx_id, uint64_t ledger_end) {
+    WalFileHeader hdr = { WAL_HDR_MAGIC, next_tx_id, ledger_end };
+
+    int fd = open(WAL_TMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return -1;
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || fsync(fd) == -1) {
+        close(fd);
+        unlink(WAL_TMP_FILE);
+        return -1;
+    }
+    close(fd);
+    if (rename(WAL_TMP_FILE, WAL_FILE) == -1) return -1;
+
+    // Make the rename itself durable
+    int dfd = open(".", O_RDONLY);
+    if (dfd != -1) {
+        fsync(dfd);
+        close(dfd);
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------
+   Bring account_db.dat and the ledger in line with the WAL, then
+   truncate it. Runs in the parent after account_table_load() and
+   ledger_open(), before any session exists.
+
+   Only the log written since the last checkpoint is read, and
+   only ledger rows appended since then are scanned, so the cost
+   is bounded by WAL_CHECKPOINT_BYTES of log, not by history.
+   Returns the number of records replayed (-1 on failure);
+   *rows_restored gets the number of ledger rows re-appended.
+   ------------------------------------------------------------ */
+int wal_recover(int *rows_restored) {
+    WalReplay st;
+    memset(&st, 0, sizeof(st));
+    *rows_restored = 0;
+
+    WalFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    off_t start = 0;
+    int have_hdr = 0;
+    int nrec = 0;
+
+    int fd = open(WAL_FILE, O_RDONLY);
+    if (fd != -1) {
+        if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+            (hdr.magic == WAL_HDR_MAGIC || hdr.magic == WAL_HDR_MAGIC_TEXT)) {
+            have_hdr = 1;
+            start = sizeof(hdr);
+            if (hdr.magic == WAL_HDR_MAGIC_TEXT) hdr.ledger_end = 0;   // from before txlog/
+        }
+
+        st.dirty = calloc(acct_table->count + 1, 1);
+        if (!st.dirty) {
+            close(fd);
+            return -1;
+        }
+        nrec = wal_scan(fd, start, wal_replay_balance, &st);
+    }
+
+    // Balances first: they are what the log exists to protect
+    if (nrec > 0) {
+        for (int slot = 0; slot < acct_table->count; slot++)
+            if (st.dirty[slot] && account_table_persist(slot) == -1) goto fail;
+        if (fsync(acct_fd) == -1) goto fail;
+    }
+
+    if (nrec > 0 && st.hi > st.lo) {
+        st.seen = calloc(st.hi - st.lo, 1);
+        if (!st.seen) goto fail;
+
+        if (ledger_scan_ids(hdr.ledger_end, st.lo, st.hi, wal_mark_seen, &st) == -1) goto fail;
+
+        wal_scan(fd, start, wal_replay_ledger, &st);
+        if (st.restored > 0 && ledger_append(st.out, st.restored) == -1) goto fail;
+        if (ledger_sync() == -1) goto fail;
+    }
+
+    // Next ledger id: the checkpoint's, pushed past anything the log or
+    // ledger used (the segment headers know the ledger's highest id)
+    int next_tx_id = have_hdr ? hdr.next_tx_id : 1;
+    if (st.hi > next_tx_id) next_tx_id = st.hi;
+    if (ledger_max_tx_id() + 1 > next_tx_id) next_tx_id = ledger_max_tx_id() + 1;
+
+    if (wal_checkpoint(next_tx_id, ledger_end()) == -1) goto fail;
+
+    if (fd != -1) close(fd);
+    free(st.dirty);
+    free(st.seen);
+    free(st.out);
+    wal_start_tx_id = next_tx_id;
+    *rows_restored = st.restored;
+    return nrec;
+
+fail:
+    perror("wal_recover");
+    if (fd != -1) close(fd);
+    free(st.dirty);
+    free(st.seen);
+    free(st.out);
+    return -1;
+}